@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "malloc.h"
+
+#define BENCH_OPERATIONS 20000 //malloc/free pairs done by every thread
+#define BENCH_WORKING_SET 32 //Live blocks kept by every thread
+#define BENCH_MAX_THREADS 32
+#define BENCH_HEAP_BYTES (4 * 1024 * 1024) //Heap size of the whole heap checksum runs
+#define BENCH_CHECKSUM_BYTES ((uint64_t)256 * 1024 * 1024) //Bytes hashed by every checksum run
+#define BENCH_REMAP_MIN ((size_t)1024 * 1024) //Smallest block grown by the realloc runs
+#define BENCH_REMAP_MAX ((size_t)256 * 1024 * 1024) //Largest block grown by the realloc runs
+#define BENCH_TRACE_OPERATIONS 200000 //Allocations and frees of every placement trace
+#define BENCH_TRACE_WORKING_SET 2000 //Live blocks kept by the placement traces
+#define BENCH_TRACE_SAMPLE 256 //Operations between two samples of the heap size
+#define BENCH_REMOTE_MESSAGES 200000 //Blocks every producer hands to its consumer
+#define BENCH_REMOTE_RING 256 //Blocks in flight between a producer and its consumer
+#define BENCH_REMOTE_MAX_PAIRS 8
+#define BENCH_BURST_BLOCKS 100000 //Blocks allocated and freed by every burst size
+#define BENCH_BURST_MAX 256
+#define BENCH_REQUESTS 5000 //Requests served by every region run
+#define BENCH_REQUEST_OBJECTS 64 //Objects allocated while serving a request
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void * small_blocks_worker(void * arg)
+{
+    //Replaces a random block of the working set with a new block of a typical small size
+    static const size_t sizes[] = {16, 24, 32, 48, 64, 96, 128, 256};
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    void * blocks[BENCH_WORKING_SET] = {0};
+
+    for (int i = 0; i < BENCH_OPERATIONS; i++)
+    {
+        int slot = rand_r(&seed) % BENCH_WORKING_SET;
+        if (blocks[slot]) heap_free(blocks[slot]);
+
+        size_t size = sizes[rand_r(&seed) % (sizeof(sizes) / sizeof(sizes[0]))];
+        blocks[slot] = heap_malloc(size);
+        if (blocks[slot]) *(char *)blocks[slot] = (char)i;
+    }
+
+    for (int i = 0; i < BENCH_WORKING_SET; i++)
+    {
+        if (blocks[i]) heap_free(blocks[i]);
+    }
+    return NULL;
+}
+
+struct remote_ring_t
+{
+    void * slots[BENCH_REMOTE_RING];
+    uint64_t head; //Written by the producer
+    uint64_t tail; //Written by the consumer
+};
+
+void * remote_producer(void * arg)
+{
+    //Allocates every message, the consumer frees it, so every free belongs to the producer's arena
+    struct remote_ring_t * ring = arg;
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    for (uint64_t i = 0; i < BENCH_REMOTE_MESSAGES; i++)
+    {
+        void * block = heap_malloc(16 + rand_r(&seed) % 240);
+        while (i - __atomic_load_n(&ring -> tail, __ATOMIC_ACQUIRE) >= BENCH_REMOTE_RING) sched_yield();
+        ring -> slots[i % BENCH_REMOTE_RING] = block;
+        __atomic_store_n(&ring -> head, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void * remote_consumer(void * arg)
+{
+    struct remote_ring_t * ring = arg;
+    for (uint64_t i = 0; i < BENCH_REMOTE_MESSAGES; i++)
+    {
+        while (__atomic_load_n(&ring -> head, __ATOMIC_ACQUIRE) == i) sched_yield();
+        heap_free(ring -> slots[i % BENCH_REMOTE_RING]);
+        __atomic_store_n(&ring -> tail, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+double run_remote_pairs(int pairs)
+{
+    static struct remote_ring_t rings[BENCH_REMOTE_MAX_PAIRS];
+    pthread_t producers[BENCH_REMOTE_MAX_PAIRS], consumers[BENCH_REMOTE_MAX_PAIRS];
+
+    double start = now_seconds();
+    for (int i = 0; i < pairs; i++)
+    {
+        rings[i].head = rings[i].tail = 0;
+        pthread_create(&producers[i], NULL, remote_producer, &rings[i]);
+        pthread_create(&consumers[i], NULL, remote_consumer, &rings[i]);
+    }
+    for (int i = 0; i < pairs; i++)
+    {
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+    }
+    return (double)pairs * BENCH_REMOTE_MESSAGES / (now_seconds() - start);
+}
+
+double run_bursts(size_t burst, int batched)
+{
+    //Allocates and frees bursts of packet sized blocks, the frees come in a different order than the allocations
+    void * blocks[BENCH_BURST_MAX];
+    size_t rounds = BENCH_BURST_BLOCKS / burst;
+
+    double start = now_seconds();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        if (batched) heap_malloc_batch(192, burst, blocks);
+        else for (size_t i = 0; i < burst; i++) blocks[i] = heap_malloc(192);
+
+        for (size_t i = 0; i < burst; i += 2)
+        {
+            void * swap = blocks[i];
+            blocks[i] = blocks[burst - 1 - i];
+            blocks[burst - 1 - i] = swap;
+        }
+
+        if (batched) heap_free_batch(blocks, burst);
+        else for (size_t i = 0; i < burst; i++) heap_free(blocks[i]);
+    }
+    return (double)rounds * burst / (now_seconds() - start);
+}
+
+double run_requests(int regions)
+{
+    //Every request allocates its objects piece by piece and drops all of them at its end
+    void * objects[BENCH_REQUEST_OBJECTS];
+    unsigned int seed = 1;
+    struct heap_region_t * region = regions ? heap_region_create(16 * 1024) : NULL;
+
+    double start = now_seconds();
+    for (int r = 0; r < BENCH_REQUESTS; r++)
+    {
+        for (int i = 0; i < BENCH_REQUEST_OBJECTS; i++)
+        {
+            size_t size = 16 + rand_r(&seed) % 240;
+            objects[i] = regions ? heap_region_alloc(region, size, 0) : heap_malloc(size);
+            *(char *)objects[i] = (char)i;
+        }
+
+        if (regions) heap_region_reset(region);
+        else for (int i = 0; i < BENCH_REQUEST_OBJECTS; i++) heap_free(objects[i]);
+    }
+    double elapsed = now_seconds() - start;
+
+    heap_region_destroy(region);
+    return BENCH_REQUESTS / elapsed;
+}
+
+size_t trace_size(unsigned int * seed)
+{
+    //Mostly small blocks, some medium ones and a few large ones
+    int kind = rand_r(seed) % 10;
+    if (kind < 6) return 16 + rand_r(seed) % 240;
+    if (kind < 9) return 256 + rand_r(seed) % 3840;
+    return 4096 + rand_r(seed) % 61440;
+}
+
+void run_trace(const char * name)
+{
+    //Every policy replays the same trace, fragmentation is 1 - largest free block / free space averaged over the samples
+    static void * blocks[BENCH_TRACE_WORKING_SET];
+    unsigned int seed = 12345;
+    size_t peak_heap = 0, peak_live = 0, live = 0;
+    double fragmentation = 0;
+    int samples = 0;
+
+    double start = now_seconds();
+    for (int i = 0; i < BENCH_TRACE_OPERATIONS; i++)
+    {
+        int slot = rand_r(&seed) % BENCH_TRACE_WORKING_SET;
+        if (blocks[slot])
+        {
+            live -= heap_get_block_size(blocks[slot]);
+            heap_free(blocks[slot]);
+            blocks[slot] = NULL;
+        }
+        else
+        {
+            size_t size = trace_size(&seed);
+            blocks[slot] = heap_malloc(size);
+            if (blocks[slot]) live += size;
+        }
+
+        if (i % BENCH_TRACE_SAMPLE == 0)
+        {
+            struct heap_arena_stats_t stats;
+            heap_collect_stats(&stats);
+            if (stats.heap_size > peak_heap) peak_heap = stats.heap_size;
+            if (live > peak_live) peak_live = live;
+            if (stats.free_space) fragmentation += 1.0 - (double)stats.largest_free_area / stats.free_space;
+            samples++;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    for (int i = 0; i < BENCH_TRACE_WORKING_SET; i++)
+    {
+        if (blocks[i]) heap_free(blocks[i]);
+        blocks[i] = NULL;
+    }
+
+    printf("%-12s %12.0f %12zu %12zu %11.1f%%\n", name, BENCH_TRACE_OPERATIONS / elapsed, peak_heap / 1024, peak_live / 1024, 100.0 * fragmentation / samples);
+}
+
+double run_threads(int threads, void * (*worker)(void *))
+{
+    pthread_t ids[BENCH_MAX_THREADS];
+
+    double start = now_seconds();
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&ids[i], NULL, worker, (void *)(uintptr_t)(i + 1));
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    return (double)threads * BENCH_OPERATIONS / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    int status = heap_setup();
+    if (status != 0)
+    {
+        printf("Heap setup failed\n");
+        return 1;
+    }
+
+    //####################################################################
+    //                    THREAD_CACHE_SCALING
+
+        printf("THREAD CACHE SCALING (malloc/free pairs per second)\n");
+        printf("%8s %16s %16s\n", "threads", "no cache", "thread cache");
+
+        for (int threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2)
+        {
+            heap_set_thread_cache(0);
+            double locked = run_threads(threads, small_blocks_worker);
+
+            heap_set_thread_cache(1);
+            double cached = run_threads(threads, small_blocks_worker);
+
+            printf("%8d %16.0f %16.0f\n", threads, locked, cached);
+        }
+        heap_set_thread_cache(0);
+
+    //####################################################################
+
+    //####################################################################
+    //                       CHECKSUM_KERNELS
+
+        printf("\nCHECKSUM KERNELS (MB per second)\n");
+        printf("%-16s %12s %12s %12s\n", "kernel", "48B header", "chunk_t", "whole heap");
+
+        //Whole heap stands for a heap filled by one large block, hashed from its header on
+        void * filler = heap_malloc(BENCH_HEAP_BYTES);
+        void * heap_start = heap_get_data_block_start(filler);
+        uint32_t heap_bytes = BENCH_HEAP_BYTES + metadata_size;
+
+        struct { const char * name; uint32_t (* kernel)(const void *, uint32_t); } kernels[] =
+        {
+            {"byte sum", byte_sum},
+            {"crc32c portable", crc32c_portable},
+#if defined(__x86_64__)
+            {"crc32c sse4.2", __builtin_cpu_supports("sse4.2") ? crc32c_sse42 : NULL},
+#endif
+        };
+
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            if (kernels[k].kernel == NULL) continue;
+            uint32_t lengths[] = {48, sizeof(struct chunk_t), heap_bytes};
+            printf("%-16s", kernels[k].name);
+            for (int l = 0; l < 3; l++)
+            {
+                uint64_t total = 0;
+                volatile uint32_t sink = 0;
+                double start = now_seconds();
+                while (total < BENCH_CHECKSUM_BYTES)
+                {
+                    sink += kernels[k].kernel(heap_start, lengths[l]);
+                    total += lengths[l];
+                }
+                printf(" %12.0f", total / (now_seconds() - start) / 1e6);
+            }
+            printf("\n");
+        }
+        heap_free(filler);
+
+    //####################################################################
+
+    //####################################################################
+    //                         REALLOC_REMAP
+
+        printf("\nREALLOC OF MAPPED BLOCKS (ms per doubling)\n");
+        printf("%12s %12s %12s\n", "size", "copy", "mremap");
+
+        heap_set_mmap_threshold(BENCH_REMAP_MIN);
+        for (size_t size = BENCH_REMAP_MIN; size <= BENCH_REMAP_MAX; size *= 4)
+        {
+            //Copy is what realloc did before, a new mapping and a memcpy of the touched block
+            char * block = heap_malloc(size);
+            if (block == NULL) break;
+            memset(block, 1, size);
+            double start = now_seconds();
+            char * moved = heap_malloc(size * 2);
+            if (moved) memcpy(moved, block, size);
+            double copy = now_seconds() - start;
+            heap_free(block);
+            heap_free(moved);
+
+            block = heap_malloc(size);
+            if (block == NULL) break;
+            memset(block, 1, size);
+            start = now_seconds();
+            block = heap_realloc(block, size * 2);
+            double remap = now_seconds() - start;
+            heap_free(block);
+
+            printf("%10zuKB %12.3f %12.3f\n", size / 1024, copy * 1e3, remap * 1e3);
+        }
+        heap_set_mmap_threshold(0);
+
+    //####################################################################
+
+    //####################################################################
+    //                       PLACEMENT_POLICIES
+
+        printf("\nPLACEMENT POLICIES (same trace for every policy)\n");
+        printf("%-12s %12s %12s %12s %12s\n", "policy", "ops/s", "peak heap KB", "peak live KB", "ext. frag.");
+
+        struct { const char * name; enum placement_policy_t policy; } policies[] =
+        {
+            {"good fit", placement_good_fit},
+            {"first fit", placement_first_fit},
+            {"next fit", placement_next_fit},
+            {"best fit", placement_best_fit},
+        };
+
+        enum validation_mode_t mode = heap_get_validation_mode();
+        heap_set_validation_mode(validation_off, 0);
+        for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+        {
+            heap_set_placement_policy(policies[p].policy);
+            heap_reset();
+            run_trace(policies[p].name);
+        }
+        heap_set_validation_mode(mode, VALIDATION_DEFAULT_PERIOD);
+        heap_set_placement_policy(placement_good_fit);
+        heap_reset();
+
+    //####################################################################
+
+    //####################################################################
+    //                             BATCHES
+
+        printf("\nBATCHES (192 byte blocks allocated and freed per second)\n");
+        printf("%8s %14s %14s %14s %14s\n", "burst", "loop", "batch", "loop no val.", "batch no val.");
+
+        mode = heap_get_validation_mode();
+        for (size_t burst = 32; burst <= BENCH_BURST_MAX; burst *= 2)
+        {
+            heap_set_validation_mode(mode, VALIDATION_DEFAULT_PERIOD);
+            double loop = run_bursts(burst, 0);
+            double batch = run_bursts(burst, 1);
+
+            heap_set_validation_mode(validation_off, 0);
+            double loop_off = run_bursts(burst, 0);
+            double batch_off = run_bursts(burst, 1);
+
+            printf("%8zu %14.0f %14.0f %14.0f %14.0f\n", burst, loop, batch, loop_off, batch_off);
+        }
+        heap_set_validation_mode(mode, VALIDATION_DEFAULT_PERIOD);
+        heap_reset();
+
+    //####################################################################
+
+    //####################################################################
+    //                             REGIONS
+
+        printf("\nREGIONS (requests of %d objects served per second)\n", BENCH_REQUEST_OBJECTS);
+        printf("%-12s %14s %14s\n", "validation", "malloc/free", "region");
+
+        mode = heap_get_validation_mode();
+        for (int off = 0; off < 2; off++)
+        {
+            if (off) heap_set_validation_mode(validation_off, 0);
+            double single = run_requests(0);
+            double region = run_requests(1);
+            printf("%-12s %14.0f %14.0f\n", off ? "off" : "default", single, region);
+        }
+        heap_set_validation_mode(mode, VALIDATION_DEFAULT_PERIOD);
+        heap_reset();
+
+    //####################################################################
+
+    //####################################################################
+    //                          REMOTE_FREES
+
+        printf("\nREMOTE FREES (blocks passed from producers to consumers per second)\n");
+        printf("%8s %16s %16s\n", "pairs", "locked free", "remote queue");
+
+        mode = heap_get_validation_mode();
+        heap_set_validation_mode(validation_off, 0);
+        for (int pairs = 1; pairs <= BENCH_REMOTE_MAX_PAIRS; pairs *= 2)
+        {
+            heap_set_remote_free(0);
+            double locked = run_remote_pairs(pairs);
+
+            heap_set_remote_free(1);
+            double queued = run_remote_pairs(pairs);
+
+            printf("%8d %16.0f %16.0f\n", pairs, locked, queued);
+        }
+        heap_set_remote_free(0);
+        heap_set_validation_mode(mode, VALIDATION_DEFAULT_PERIOD);
+        heap_reset();
+
+    //####################################################################
+
+    destroy_mutex();
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "malloc.h"
+
+//Standard allocator workloads run against the heap and against the malloc of libc
+//Built like bench.c, e.g. gcc -O2 bench_suite.c malloc.c -lpthread
+//Usage: ./a.out [output.csv] [threads]
+
+#define SUITE_OPERATIONS 100000 //Timed operations done by every thread of a workload
+#define SUITE_MAX_THREADS 32
+#define SUITE_WORKING_SET 1000 //Live blocks kept by every thread of the churn workloads
+#define SUITE_LARSON_ROUNDS 10 //Times the threads pass their working sets on
+#define SUITE_RING_SIZE 1024 //Blocks in flight between a producer and its consumer
+#define SUITE_PING_PONG_SIZE 64
+#define SUITE_REALLOC_LIMIT (1024 * 1024) //Size the realloc workload grows a buffer to
+#define SUITE_RSS_PERIOD_US 1000 //Period of the RSS samples
+
+struct allocator_t
+{
+    const char * name;
+    void * (* alloc)(size_t);
+    void (* release)(void *);
+    void * (* resize)(void *, size_t);
+};
+
+struct ring_t
+{
+    void * slots[SUITE_RING_SIZE];
+    uint64_t head; //Written by the producer only
+    uint64_t tail; //Written by the consumer only
+};
+
+struct worker_t
+{
+    const struct allocator_t * allocator;
+    int index;
+    int threads;
+    uint64_t * latencies; //Nanoseconds of every timed operation
+    size_t count;
+};
+
+struct ring_t rings[SUITE_MAX_THREADS / 2];
+void ** larsonSets[SUITE_MAX_THREADS];
+pthread_barrier_t larsonBarrier;
+int rssRunning = 0;
+size_t rssPeak = 0;
+
+void * heap_alloc(size_t size) { return heap_malloc(size); }
+void heap_release(void * ptr) { heap_free(ptr); }
+void * heap_resize(void * ptr, size_t size) { return heap_realloc(ptr, size); }
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void * timed_alloc(struct worker_t * worker, size_t size)
+{
+    uint64_t start = now_ns();
+    void * ptr = worker -> allocator -> alloc(size);
+    worker -> latencies[worker -> count++] = now_ns() - start;
+    if (ptr) *(char *)ptr = 1;
+    return ptr;
+}
+
+void timed_release(struct worker_t * worker, void * ptr)
+{
+    uint64_t start = now_ns();
+    worker -> allocator -> release(ptr);
+    worker -> latencies[worker -> count++] = now_ns() - start;
+}
+
+size_t random_size(unsigned int * seed, size_t min, size_t max)
+{
+    return min + rand_r(seed) % (max - min + 1);
+}
+
+void * producer_consumer_worker(void * arg)
+{
+    //Even threads allocate and hand the blocks to the next odd thread which frees them
+    struct worker_t * worker = arg;
+    struct ring_t * ring = &rings[worker -> index / 2];
+    unsigned int seed = worker -> index + 1;
+
+    if (worker -> index % 2 == 0)
+    {
+        for (int i = 0; i <= SUITE_OPERATIONS / 2; i++)
+        {
+            void * ptr = i < SUITE_OPERATIONS / 2 ? timed_alloc(worker, random_size(&seed, 16, 512)) : NULL; //NULL ends the stream
+            while (ring -> head - __atomic_load_n(&ring -> tail, __ATOMIC_ACQUIRE) == SUITE_RING_SIZE) sched_yield();
+            ring -> slots[ring -> head % SUITE_RING_SIZE] = ptr;
+            __atomic_store_n(&ring -> head, ring -> head + 1, __ATOMIC_RELEASE);
+        }
+    }
+    else
+    {
+        while (1)
+        {
+            while (__atomic_load_n(&ring -> head, __ATOMIC_ACQUIRE) == ring -> tail) sched_yield();
+            void * ptr = ring -> slots[ring -> tail % SUITE_RING_SIZE];
+            __atomic_store_n(&ring -> tail, ring -> tail + 1, __ATOMIC_RELEASE);
+            if (ptr == NULL) break;
+            timed_release(worker, ptr);
+        }
+    }
+    return NULL;
+}
+
+void * larson_worker(void * arg)
+{
+    //Every round the threads churn a working set they got from another thread, so blocks are freed by other threads
+    struct worker_t * worker = arg;
+    unsigned int seed = worker -> index + 1;
+    int operations = SUITE_OPERATIONS / 2 / SUITE_LARSON_ROUNDS;
+
+    for (int round = 0; round < SUITE_LARSON_ROUNDS; round++)
+    {
+        void ** blocks = larsonSets[(worker -> index + round) % worker -> threads];
+        for (int i = 0; i < operations; i++)
+        {
+            int slot = rand_r(&seed) % SUITE_WORKING_SET;
+            if (blocks[slot]) timed_release(worker, blocks[slot]);
+            blocks[slot] = timed_alloc(worker, random_size(&seed, 16, 1024));
+        }
+        pthread_barrier_wait(&larsonBarrier);
+    }
+
+    void ** blocks = larsonSets[(worker -> index + SUITE_LARSON_ROUNDS) % worker -> threads];
+    for (int i = 0; i < SUITE_WORKING_SET; i++)
+    {
+        if (blocks[i]) worker -> allocator -> release(blocks[i]);
+        blocks[i] = NULL;
+    }
+    return NULL;
+}
+
+void * ping_pong_worker(void * arg)
+{
+    //Allocates and frees blocks of a single size, the best case of every allocator
+    struct worker_t * worker = arg;
+    for (int i = 0; i < SUITE_OPERATIONS / 2; i++)
+    {
+        timed_release(worker, timed_alloc(worker, SUITE_PING_PONG_SIZE));
+    }
+    return NULL;
+}
+
+void * random_mix_worker(void * arg)
+{
+    //Random sizes from a few bytes to a few pages replace random blocks of the working set
+    struct worker_t * worker = arg;
+    unsigned int seed = worker -> index + 1;
+    void * blocks[SUITE_WORKING_SET] = {0};
+
+    for (int i = 0; i < SUITE_OPERATIONS / 2; i++)
+    {
+        int slot = rand_r(&seed) % SUITE_WORKING_SET;
+        if (blocks[slot]) timed_release(worker, blocks[slot]);
+        blocks[slot] = timed_alloc(worker, random_size(&seed, 8, 8192));
+    }
+
+    for (int i = 0; i < SUITE_WORKING_SET; i++)
+    {
+        if (blocks[i]) worker -> allocator -> release(blocks[i]);
+    }
+    return NULL;
+}
+
+void * realloc_growth_worker(void * arg)
+{
+    //Grows a buffer by half of its size at a time, like a vector being appended to
+    struct worker_t * worker = arg;
+    while (worker -> count < SUITE_OPERATIONS)
+    {
+        char * buffer = timed_alloc(worker, 16);
+        for (size_t size = 40; size <= SUITE_REALLOC_LIMIT && worker -> count < SUITE_OPERATIONS; size += size / 2)
+        {
+            uint64_t start = now_ns();
+            char * grown = worker -> allocator -> resize(buffer, size);
+            worker -> latencies[worker -> count++] = now_ns() - start;
+            if (grown == NULL) break;
+            buffer = grown;
+            buffer[size - 1] = 1;
+        }
+        worker -> allocator -> release(buffer);
+    }
+    return NULL;
+}
+
+size_t current_rss(void)
+{
+    long pages = 0, resident = 0;
+    FILE * statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(statm);
+    return (size_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+void * rss_monitor(void * unused)
+{
+    while (__atomic_load_n(&rssRunning, __ATOMIC_ACQUIRE))
+    {
+        size_t rss = current_rss();
+        if (rss > rssPeak) rssPeak = rss;
+        usleep(SUITE_RSS_PERIOD_US);
+    }
+    return NULL;
+}
+
+int compare_latencies(const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void run_workload(const char * name, void * (* body)(void *), const struct allocator_t * allocator, int threads, FILE * csv)
+{
+    //Threads run the workload while the monitor samples RSS, latencies of all threads are merged afterwards
+    struct worker_t workers[SUITE_MAX_THREADS];
+    pthread_t ids[SUITE_MAX_THREADS];
+    pthread_t monitor;
+
+    memset(rings, 0, sizeof(rings));
+    pthread_barrier_init(&larsonBarrier, NULL, threads);
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i] = (struct worker_t){allocator, i, threads, malloc(SUITE_OPERATIONS * sizeof(uint64_t)), 0};
+        larsonSets[i] = calloc(SUITE_WORKING_SET, sizeof(void *));
+    }
+
+    rssPeak = current_rss();
+    __atomic_store_n(&rssRunning, 1, __ATOMIC_RELEASE);
+    pthread_create(&monitor, NULL, rss_monitor, NULL);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < threads; i++) pthread_create(&ids[i], NULL, body, &workers[i]);
+    for (int i = 0; i < threads; i++) pthread_join(ids[i], NULL);
+    double elapsed = (now_ns() - start) / 1e9;
+
+    __atomic_store_n(&rssRunning, 0, __ATOMIC_RELEASE);
+    pthread_join(monitor, NULL);
+
+    size_t total = 0;
+    for (int i = 0; i < threads; i++) total += workers[i].count;
+    uint64_t * merged = malloc((total ? total : 1) * sizeof(uint64_t));
+    size_t offset = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        memcpy(merged + offset, workers[i].latencies, workers[i].count * sizeof(uint64_t));
+        offset += workers[i].count;
+        free(workers[i].latencies);
+        free(larsonSets[i]);
+    }
+    qsort(merged, total, sizeof(uint64_t), compare_latencies);
+
+    uint64_t p50 = total ? merged[total * 50 / 100] : 0;
+    uint64_t p99 = total ? merged[total * 99 / 100] : 0;
+    uint64_t p999 = total ? merged[total * 999 / 1000] : 0;
+    free(merged);
+    pthread_barrier_destroy(&larsonBarrier);
+
+    printf("%-18s %-6s %8d %12.0f %10lu %10lu %10lu %12zu\n", name, allocator -> name, threads, total / elapsed,
+        (unsigned long)p50, (unsigned long)p99, (unsigned long)p999, rssPeak / 1024);
+    if (csv)
+    {
+        fprintf(csv, "%s,%s,%d,%zu,%.0f,%lu,%lu,%lu,%zu\n", name, allocator -> name, threads, total, total / elapsed,
+            (unsigned long)p50, (unsigned long)p99, (unsigned long)p999, rssPeak / 1024);
+        fflush(csv);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char * output = argc > 1 ? argv[1] : "bench_suite.csv";
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    if (threads < 2) threads = 2;
+    if (threads > SUITE_MAX_THREADS) threads = SUITE_MAX_THREADS;
+    threads &= ~1; //Producers and consumers come in pairs
+
+    //Full walks of the heap on every call would be measured otherwise, HEAP_VALIDATE still overrides it
+    heap_set_validation_mode(validation_off, VALIDATION_DEFAULT_PERIOD);
+    if (heap_setup() != 0)
+    {
+        printf("Heap setup failed\n");
+        return 1;
+    }
+
+    FILE * csv = fopen(output, "w");
+    if (csv == NULL) printf("Couldn't open %s, results go to stdout only\n", output);
+    else fprintf(csv, "workload,allocator,threads,operations,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_kb\n");
+
+    struct allocator_t allocators[] =
+    {
+        {"heap", heap_alloc, heap_release, heap_resize},
+        {"libc", malloc, free, realloc},
+    };
+
+    struct { const char * name; void * (* body)(void *); } workloads[] =
+    {
+        {"producer_consumer", producer_consumer_worker},
+        {"larson", larson_worker},
+        {"ping_pong", ping_pong_worker},
+        {"random_mix", random_mix_worker},
+        {"realloc_growth", realloc_growth_worker},
+    };
+
+    printf("%-18s %-6s %8s %12s %10s %10s %10s %12s\n", "workload", "alloc", "threads", "ops/s", "p50 ns", "p99 ns", "p999 ns", "peak RSS KB");
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+    {
+        for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++)
+        {
+            run_workload(workloads[w].name, workloads[w].body, &allocators[a], threads, csv);
+        }
+    }
+
+    if (csv) fclose(csv);
+    destroy_mutex();
+    return 0;
+}
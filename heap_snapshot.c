@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "heap_snapshot.h"
+
+//Offline analyzer of the snapshots written by heap_write_snapshot, it doesn't link the heap
+//Built with gcc -O2 -o heap_snapshot heap_snapshot.c
+//Usage: ./heap_snapshot summary|map|sites file [columns] or ./heap_snapshot diff old new
+
+#define MAP_DEFAULT_COLUMNS 64
+#define MAP_MAX_ROWS 32
+#define SNAPSHOT_MAX_SECTIONS 64 //Arena and mapping sections read from a snapshot, more than any heap writes
+
+struct section_t
+{
+    struct heap_snapshot_section_t header;
+    struct heap_snapshot_record_t * records;
+};
+
+struct snapshot_t
+{
+    struct heap_snapshot_header_t header;
+    struct section_t sections[SNAPSHOT_MAX_SECTIONS];
+    int section_count;
+    struct heap_snapshot_string_t * strings;
+    char ** names;
+    uint64_t string_count;
+};
+
+struct site_total_t
+{
+    const char * filename;
+    int line;
+    uint64_t bytes;
+    uint64_t count;
+};
+
+struct site_change_t
+{
+    const char * filename;
+    int line;
+    int64_t bytes;
+    int64_t blocks;
+};
+
+int read_exact(FILE * in, void * data, size_t length)
+{
+    return fread(data, 1, length, in) == length ? 0 : -1;
+}
+
+int load_snapshot(const char * path, struct snapshot_t * snapshot)
+{
+    FILE * in = fopen(path, "rb");
+    if (in == NULL)
+    {
+        printf("Couldn't open %s\n", path);
+        return -1;
+    }
+
+    memset(snapshot, 0, sizeof(struct snapshot_t));
+    if (read_exact(in, &snapshot -> header, sizeof(snapshot -> header)) < 0 || memcmp(snapshot -> header.magic, HEAP_SNAPSHOT_MAGIC, 8) != 0
+        || snapshot -> header.version != HEAP_SNAPSHOT_VERSION)
+    {
+        printf("%s is not a heap snapshot of version %d\n", path, HEAP_SNAPSHOT_VERSION);
+        fclose(in);
+        return -1;
+    }
+
+    while (1)
+    {
+        struct heap_snapshot_section_t section;
+        if (read_exact(in, &section, sizeof(section)) < 0) break;
+        if (section.kind == snapshot_end)
+        {
+            fclose(in);
+            return 0;
+        }
+
+        if (section.kind == snapshot_strings)
+        {
+            snapshot -> string_count = section.count;
+            snapshot -> strings = calloc(section.count + 1, sizeof(struct heap_snapshot_string_t));
+            snapshot -> names = calloc(section.count + 1, sizeof(char *));
+            for (uint64_t i = 0; i < section.count; i++)
+            {
+                if (read_exact(in, &snapshot -> strings[i], sizeof(struct heap_snapshot_string_t)) < 0) break;
+                snapshot -> names[i] = calloc(snapshot -> strings[i].length + 1, 1);
+                if (read_exact(in, snapshot -> names[i], snapshot -> strings[i].length) < 0) break;
+            }
+            continue;
+        }
+
+        if (snapshot -> section_count == SNAPSHOT_MAX_SECTIONS) break;
+        struct section_t * target = &snapshot -> sections[snapshot -> section_count++];
+        target -> header = section;
+        target -> records = calloc(section.count + 1, sizeof(struct heap_snapshot_record_t));
+        if (read_exact(in, target -> records, section.count * sizeof(struct heap_snapshot_record_t)) < 0) break;
+    }
+
+    printf("%s is truncated\n", path);
+    fclose(in);
+    return -1;
+}
+
+const char * record_filename(const struct snapshot_t * snapshot, const struct heap_snapshot_record_t * record)
+{
+    //Strings are few, a linear search is fine next to reading the records
+    for (uint64_t i = 0; i < snapshot -> string_count; i++)
+    {
+        if (snapshot -> strings[i].id == record -> filename) return snapshot -> names[i];
+    }
+    return "unknown";
+}
+
+void print_summary(const struct snapshot_t * snapshot)
+{
+    printf("snapshot taken at %.3f s, metadata %u bytes per block\n", snapshot -> header.time_ns / 1e9, snapshot -> header.metadata);
+    printf("%-10s %14s %10s %14s %10s %14s %14s %10s\n", "section", "size", "used", "used bytes", "free", "free bytes", "largest free", "ext. frag.");
+
+    for (int s = 0; s < snapshot -> section_count; s++)
+    {
+        const struct section_t * section = &snapshot -> sections[s];
+        uint64_t used = 0, used_bytes = 0, free_count = 0, free_bytes = 0, largest = 0;
+        for (uint64_t r = 0; r < section -> header.count; r++)
+        {
+            const struct heap_snapshot_record_t * record = &section -> records[r];
+            if (record -> flags & SNAPSHOT_TAKEN)
+            {
+                used++;
+                used_bytes += record -> size;
+            }
+            else
+            {
+                free_count++;
+                free_bytes += record -> size;
+                if (record -> size > largest) largest = record -> size;
+            }
+        }
+
+        char name[16];
+        if (section -> header.kind == snapshot_arena) snprintf(name, sizeof(name), "arena %d", section -> header.index);
+        else snprintf(name, sizeof(name), "mapped");
+        printf("%-10s %14lu %10lu %14lu %10lu %14lu %14lu %9.1f%%\n", name, (unsigned long)section -> header.length, (unsigned long)used,
+            (unsigned long)used_bytes, (unsigned long)free_count, (unsigned long)free_bytes, (unsigned long)largest,
+            free_bytes ? 100.0 * (1.0 - (double)largest / free_bytes) : 0.0);
+    }
+}
+
+void print_map(const struct snapshot_t * snapshot, int columns)
+{
+    //Every cell covers the same bytes of an arena, its mark tells how much of them blocks in use take
+    static const char marks[] = ".:-+*#";
+    printf("cells: '.' free, ':' < 25%%, '-' < 50%%, '+' < 75%%, '*' < 100%%, '#' in use\n");
+
+    for (int s = 0; s < snapshot -> section_count; s++)
+    {
+        const struct section_t * section = &snapshot -> sections[s];
+        if (section -> header.kind != snapshot_arena || section -> header.length == 0) continue;
+
+        uint64_t cells = (uint64_t)columns * MAP_MAX_ROWS;
+        uint64_t cell_bytes = (section -> header.length + cells - 1) / cells;
+        uint64_t page = snapshot -> header.page_size;
+        if (cell_bytes < page) cell_bytes = page;
+        cell_bytes = (cell_bytes + page - 1) / page * page;
+        cells = (section -> header.length + cell_bytes - 1) / cell_bytes;
+
+        uint64_t * used = calloc(cells, sizeof(uint64_t));
+        for (uint64_t r = 0; r < section -> header.count; r++)
+        {
+            const struct heap_snapshot_record_t * record = &section -> records[r];
+            if (!(record -> flags & SNAPSHOT_TAKEN)) continue;
+
+            uint64_t begin = record -> address - section -> header.start;
+            uint64_t end = begin + snapshot -> header.metadata + record -> size;
+            for (uint64_t cell = begin / cell_bytes; cell < cells && cell * cell_bytes < end; cell++)
+            {
+                uint64_t low = cell * cell_bytes > begin ? cell * cell_bytes : begin;
+                uint64_t high = (cell + 1) * cell_bytes < end ? (cell + 1) * cell_bytes : end;
+                used[cell] += high - low;
+            }
+        }
+
+        printf("\narena %d, %lu bytes, %lu bytes per cell\n", section -> header.index, (unsigned long)section -> header.length, (unsigned long)cell_bytes);
+        for (uint64_t cell = 0; cell < cells; cell++)
+        {
+            double ratio = (double)used[cell] / cell_bytes;
+            int mark = used[cell] == 0 ? 0 : ratio >= 1.0 ? 5 : 1 + (int)(ratio * 4);
+            putchar(marks[mark]);
+            if ((cell + 1) % columns == 0 || cell + 1 == cells) putchar('\n');
+        }
+        free(used);
+    }
+}
+
+int compare_sites(const void * a, const void * b)
+{
+    const struct site_total_t * x = a, * y = b;
+    int res = strcmp(x -> filename, y -> filename);
+    return res ? res : (x -> line > y -> line) - (x -> line < y -> line);
+}
+
+int compare_site_bytes(const void * a, const void * b)
+{
+    const struct site_total_t * x = a, * y = b;
+    return (x -> bytes < y -> bytes) - (x -> bytes > y -> bytes);
+}
+
+size_t collect_sites(const struct snapshot_t * snapshot, struct site_total_t ** out)
+{
+    //Blocks in use grouped by filename and line, sorted by site
+    size_t count = 0;
+    for (int s = 0; s < snapshot -> section_count; s++) count += snapshot -> sections[s].header.count;
+
+    struct site_total_t * blocks = calloc(count + 1, sizeof(struct site_total_t));
+    size_t used = 0;
+    for (int s = 0; s < snapshot -> section_count; s++)
+    {
+        const struct section_t * section = &snapshot -> sections[s];
+        for (uint64_t r = 0; r < section -> header.count; r++)
+        {
+            const struct heap_snapshot_record_t * record = &section -> records[r];
+            if (!(record -> flags & SNAPSHOT_TAKEN)) continue;
+            blocks[used++] = (struct site_total_t){record_filename(snapshot, record), record -> line, record -> size, 1};
+        }
+    }
+    qsort(blocks, used, sizeof(struct site_total_t), compare_sites);
+
+    size_t sites = 0;
+    for (size_t i = 0; i < used; i++)
+    {
+        if (sites && compare_sites(&blocks[sites - 1], &blocks[i]) == 0)
+        {
+            blocks[sites - 1].bytes += blocks[i].bytes;
+            blocks[sites - 1].count++;
+        }
+        else blocks[sites++] = blocks[i];
+    }
+    *out = blocks;
+    return sites;
+}
+
+void print_sites(const struct snapshot_t * snapshot)
+{
+    struct site_total_t * sites;
+    size_t count = collect_sites(snapshot, &sites);
+    qsort(sites, count, sizeof(struct site_total_t), compare_site_bytes);
+
+    printf("%14s %10s  %s\n", "bytes", "blocks", "site");
+    for (size_t i = 0; i < count; i++)
+    {
+        printf("%14lu %10lu  %s:%d\n", (unsigned long)sites[i].bytes, (unsigned long)sites[i].count, sites[i].filename, sites[i].line);
+    }
+    free(sites);
+}
+
+int compare_changes(const void * a, const void * b)
+{
+    const struct site_change_t * x = a, * y = b;
+    return (x -> bytes < y -> bytes) - (x -> bytes > y -> bytes);
+}
+
+void print_diff(const struct snapshot_t * before, const struct snapshot_t * after)
+{
+    //Sites whose blocks in use changed, biggest growth first
+    struct site_total_t * old_sites, * new_sites;
+    size_t old_count = collect_sites(before, &old_sites);
+    size_t new_count = collect_sites(after, &new_sites);
+
+    struct site_change_t * changes = calloc(old_count + new_count + 1, sizeof(struct site_change_t));
+    size_t changed = 0, i = 0, j = 0;
+    while (i < old_count || j < new_count)
+    {
+        //Both lists are sorted by site, so they are merged like sorted runs
+        int order = i == old_count ? 1 : j == new_count ? -1 : compare_sites(&old_sites[i], &new_sites[j]);
+        const struct site_total_t * site = order <= 0 ? &old_sites[i] : &new_sites[j];
+        struct site_change_t change = {site -> filename, site -> line, 0, 0};
+        if (order >= 0)
+        {
+            change.bytes += new_sites[j].bytes;
+            change.blocks += new_sites[j++].count;
+        }
+        if (order <= 0)
+        {
+            change.bytes -= old_sites[i].bytes;
+            change.blocks -= old_sites[i++].count;
+        }
+        if (change.bytes || change.blocks) changes[changed++] = change;
+    }
+    qsort(changes, changed, sizeof(struct site_change_t), compare_changes);
+
+    printf("%+.3f s between the snapshots\n", ((double)after -> header.time_ns - before -> header.time_ns) / 1e9);
+    printf("%14s %10s  %s\n", "bytes", "blocks", "site");
+    for (size_t k = 0; k < changed; k++)
+    {
+        printf("%+14ld %+10ld  %s:%d\n", (long)changes[k].bytes, (long)changes[k].blocks, changes[k].filename, changes[k].line);
+    }
+
+    free(changes);
+    free(old_sites);
+    free(new_sites);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || (strcmp(argv[1], "diff") == 0 && argc < 4))
+    {
+        printf("Usage: %s summary|map|sites file [columns]\n       %s diff old new\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    struct snapshot_t snapshot;
+    if (load_snapshot(argv[2], &snapshot) < 0) return 1;
+
+    if (strcmp(argv[1], "summary") == 0) print_summary(&snapshot);
+    else if (strcmp(argv[1], "map") == 0) print_map(&snapshot, argc > 3 && atoi(argv[3]) > 0 ? atoi(argv[3]) : MAP_DEFAULT_COLUMNS);
+    else if (strcmp(argv[1], "sites") == 0) print_sites(&snapshot);
+    else if (strcmp(argv[1], "diff") == 0)
+    {
+        struct snapshot_t after;
+        if (load_snapshot(argv[3], &after) < 0) return 1;
+        print_diff(&snapshot, &after);
+    }
+    else
+    {
+        printf("Unknown command %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef _HEAP_SNAPSHOT_H_
+#define _HEAP_SNAPSHOT_H_
+
+//Format of the snapshots written by heap_write_snapshot, shared with the standalone analyzer
+#include <stdint.h>
+
+#define HEAP_SNAPSHOT_MAGIC "HEAPSNP" //Eight bytes with the terminating zero
+#define HEAP_SNAPSHOT_VERSION 1
+#define SNAPSHOT_TAKEN 1 //Flags of a snapshot record
+#define SNAPSHOT_SLAB 2
+#define SNAPSHOT_MAPPED 4
+
+enum snapshot_section_kind_t
+{
+    snapshot_arena, //Records of every chunk of an arena in address order
+    snapshot_mappings, //Records of the blocks with a mapping of their own
+    snapshot_strings, //Filenames the records refer to
+    snapshot_end
+};
+
+//Snapshot file: a header, sections each followed by their records, a strings section and an end section
+//Fields are in the byte order of the machine which wrote the snapshot
+struct heap_snapshot_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t metadata; //Bytes of header and fences around every payload
+    uint64_t time_ns; //Wall clock time of the snapshot
+    uint32_t page_size;
+    uint32_t reserved;
+};
+
+struct heap_snapshot_section_t
+{
+    uint32_t kind; //enum snapshot_section_kind_t
+    int32_t index; //Arena number
+    uint64_t start; //Address of the arena
+    uint64_t length; //Bytes of the arena or of all mappings
+    uint64_t count; //Records or strings following the section
+};
+
+struct heap_snapshot_record_t
+{
+    uint64_t address; //Chunk header
+    uint64_t filename; //Address of the filename, matched by the strings section, 0 for free chunks
+    uint32_t size; //Payload
+    int32_t line;
+    uint32_t flags; //SNAPSHOT_TAKEN, SNAPSHOT_SLAB, SNAPSHOT_MAPPED
+    uint32_t objects; //Objects in use of a slab
+};
+
+struct heap_snapshot_string_t
+{
+    uint64_t id; //Address used by the records
+    uint32_t length; //Bytes following, without a terminating zero
+    uint32_t reserved;
+};
+
+#endif
@@ -1,16 +1,117 @@
+#define _GNU_SOURCE //mremap
 #include "malloc.h"
 #include <pthread.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <execinfo.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <x86intrin.h>
+#endif
+
+//The first arena grows with custom_sbrk, the others live in their own reserved mappings
+struct arena_t arenas[HEAP_MAX_ARENAS] = 
+{
+    [0 ... HEAP_MAX_ARENAS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}
+};
+int arenaCount = 0; //Set with heap_set_arena_count or HEAP_ARENAS=n, defaults to the number of CPUs
+pthread_mutex_t arenasMutex = PTHREAD_MUTEX_INITIALIZER;
+__thread struct arena_t * threadArena;
+
+int threadCacheEnabled = 0; //Set with heap_set_thread_cache or HEAP_TCACHE=1
+int slabEnabled = 0; //Set with heap_set_slab or HEAP_SLAB=1
+int remoteFreeEnabled = 0; //Set with heap_set_remote_free or HEAP_REMOTE_FREE=1
+enum placement_policy_t placementPolicy = placement_good_fit; //Set with heap_set_placement_policy or HEAP_PLACEMENT=good|first|next|best
+size_t mmapThreshold = 0; //Set with heap_set_mmap_threshold or HEAP_MMAP_THRESHOLD=bytes, 0 keeps every block in the heap
+struct mapping_t mappings[HEAP_MAX_MAPPINGS]; //Sorted by address
+int mappingCount = 0;
+struct size_index_t mappingSizes; //Sizes of the mapped blocks
+size_t mappedBytes = 0; //Length of all mappings together
+pthread_mutex_t mappingsMutex = PTHREAD_MUTEX_INITIALIZER;
+size_t trimThreshold = TRIM_DEFAULT_THRESHOLD; //Set with heap_set_trim_threshold or HEAP_TRIM_THRESHOLD=bytes, 0 disables trimming in heap_free
+uint64_t trimmedBytes = 0; //Bytes given back to the OS by trimming and arena resets
+int messagesEnabled = 1; //Set with heap_set_messages or HEAP_MESSAGES=0, the preload shim starts with them off
+int siteTableEnabled = 1; //Set with heap_set_site_table or HEAP_SITES=0, used only by compact headers
+int profileEnabled = 0; //Set with heap_set_site_profile or HEAP_PROFILE=1
+struct profile_table_t siteProfile; //Bytes and blocks of every allocation site
+pthread_mutex_t profileMutex = PTHREAD_MUTEX_INITIALIZER; //Taken after an arena lock or mappingsMutex, never before
+__thread int profileParking; //Set while blocks move between the thread cache and the heap, cached blocks aren't live
+size_t sampleInterval = 0; //Set with heap_set_sample_interval or HEAP_SAMPLE_INTERVAL=bytes, 0 turns sampling off
+struct sample_table_t samples; //Sampled blocks still in use, keyed by their address
+uint8_t sampleFilter[SAMPLE_FILTER_SIZE]; //Samples per hash of the address, lets heap_free skip the lock for blocks never sampled
+pthread_mutex_t samplesMutex = PTHREAD_MUTEX_INITIALIZER; //Never held while calling into the heap
+__thread int64_t sampleCountdown; //Bytes the thread allocates before its next sample
+__thread uint64_t sampleSeed;
+__thread int sampleBusy; //Set while a sample is taken, backtrace may allocate
+uint64_t heapGeneration = 0; //Bumped by heap_setup so caches drop blocks of an old heap
+__thread struct thread_cache_t threadCache;
+__thread int threadRegistered;
+pthread_key_t threadKey;
+pthread_once_t threadOnce = PTHREAD_ONCE_INIT;
+
+enum validation_mode_t validationMode = validation_full; //Set with heap_set_validation_mode or HEAP_VALIDATE=mode
+int validationPeriod = VALIDATION_DEFAULT_PERIOD; //Set with heap_set_validation_mode or HEAP_VALIDATE_PERIOD=n
+uint64_t validationOperations = 0; //Operations seen by the sampled mode
+uint64_t validationCount = 0; //Arena walks and chunk checks done so far
+
+int latencyEnabled = 0; //Set with heap_set_latency_tracking or HEAP_LATENCY=1
+struct latency_table_t * latencyTables = NULL; //Tables of every thread which recorded a latency, never freed
+pthread_mutex_t latencyMutex = PTHREAD_MUTEX_INITIALIZER;
+__thread struct latency_table_t * latencyTable;
+__thread int latencyDepth; //Public functions called by another public function aren't recorded on their own
+const char * latencyNames[LATENCY_KIND_COUNT] = {"malloc", "calloc", "realloc", "free", "memalign", "lock wait", "search", "grow", "split", "validate"};
+
+uint32_t (* checksumKernel)(const void *, uint32_t) = checksum_select; //Replaced by the best kernel on first use
+uint32_t crc32cTable[8][256]; //Tables of the portable kernel, 8 bytes are folded per step
+
+void heap_message(const char * format, ...)
+{
+    //Diagnostics of the allocator, a process using it as its malloc may not want them on its stdout
+    if (!messagesEnabled) return;
+
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
 
-heap myHeap;
-struct chunk_t firstChunk;
-pthread_mutex_t myMutex = PTHREAD_MUTEX_INITIALIZER;
+void heap_set_messages(int enabled)
+{
+    messagesEnabled = enabled;
+}
 
 void destroy_mutex()
 {
-    pthread_mutex_destroy(&myMutex);
+    for (int i = 0; i < HEAP_MAX_ARENAS; i++)
+    {
+        pthread_mutex_destroy(&arenas[i].lock);
+    }
+    pthread_mutex_destroy(&arenasMutex);
+    pthread_mutex_destroy(&mappingsMutex);
 }
 
 int heap_validate(void)
+{
+    //Validates every arena in use and returns the first error found
+    for (int i = 0; i < HEAP_MAX_ARENAS; i++)
+    {
+        struct arena_t * arena = &arenas[i];
+        if (i > 0 && arena -> heap.heap == NULL) continue;
+
+        pthread_mutex_lock(&arena -> lock);
+        int res = arena_validate(arena);
+        pthread_mutex_unlock(&arena -> lock);
+        if (res < 0) return res;
+    }
+    return mappings_validate();
+}
+
+int arena_validate(struct arena_t * arena)
 {
     //Returns:
     //-1 : Heap struct is wrong
@@ -18,29 +119,34 @@ int heap_validate(void)
     //-3 : Other chunks of heap are wrong;
     
     //Validate heap itself (pointers pointing correctly and checksums are valid)
-    if (myHeap.heap == NULL) return -1;
+    if (arena -> heap.heap == NULL) return -1;
+    __atomic_add_fetch(&validationCount, 1, __ATOMIC_RELAXED);
     
-    int tempChecksum = myHeap.checksum;
-    myHeap.checksum = 0;
-    if (tempChecksum != add_bytes(&myHeap, sizeof(myHeap))) return -1;
-    myHeap.checksum = tempChecksum;
+    int tempChecksum = arena -> heap.checksum;
+    arena -> heap.checksum = 0;
+    if (tempChecksum != add_bytes(&arena -> heap, sizeof(heap))) return -1;
+    arena -> heap.checksum = tempChecksum;
 
-    if (myHeap.max_heap_size < PAGE_SIZE) return -1;
-    if (myHeap.chunk_count < 0) return -1;
+    if (arena -> heap.max_heap_size < PAGE_SIZE) return -1;
+    if (arena -> heap.chunk_count < 0) return -1;
 
     //Validate first chunk (pointers pointing correctly and checksums are valid)
-    if (myHeap.first_chunk != myHeap.heap) {printf("First block address isn't heap address\n"); return -2;}
-    if (myHeap.first_chunk -> next == NULL && myHeap.chunk_count > 1) {printf("First block next pointer is NULL\n"); return -2;}
-    if (myHeap.first_chunk -> prev != NULL) {printf("First block prev pointer isn't NULL\n"); return -2;}
+    if (arena -> heap.first_chunk != arena -> heap.heap) {heap_message("First block address isn't heap address\n"); return -2;}
+    if (chunk_next(arena -> heap.first_chunk) == NULL && arena -> heap.chunk_count > 1) {heap_message("First block next pointer is NULL\n"); return -2;}
+    if (chunk_prev(arena -> heap.first_chunk) != NULL) {heap_message("First block prev pointer isn't NULL\n"); return -2;}
     
-    tempChecksum = myHeap.first_chunk -> checksum;
-    myHeap.first_chunk -> checksum = 0;
-    if (tempChecksum != add_bytes(myHeap.first_chunk, sizeof(struct chunk_t))) {printf("First block checksum is incorrect\n"); return -2;}
-    myHeap.first_chunk -> checksum = tempChecksum;    
+    tempChecksum = arena -> heap.first_chunk -> checksum;
+    arena -> heap.first_chunk -> checksum = 0;
+    if (tempChecksum != add_bytes(arena -> heap.first_chunk, sizeof(struct chunk_t))) {heap_message("First block checksum is incorrect\n"); return -2;}
+    arena -> heap.first_chunk -> checksum = tempChecksum;    
     
 
     
-    if (myHeap.chunk_count > 0)
+    struct heap_arena_stats_t counted;
+    memset(&counted, 0, sizeof(counted));
+    chunk_count_stats(arena -> heap.first_chunk, &counted);
+
+    if (arena -> heap.chunk_count > 0)
     {
         char fence[fence_size];
         for (int i = 0; i < fence_size; i++)
@@ -48,53 +154,62 @@ int heap_validate(void)
             fence[i] = i;
         }
         //Validate first chunk fences
-        char * chunk_fence = (((char *)myHeap.first_chunk) + sizeof(struct chunk_t));
-        char * chunk_fence2 = (((char *)myHeap.first_chunk) + move_to_data_block + myHeap.first_chunk -> size);
+        char * chunk_fence = (((char *)arena -> heap.first_chunk) + sizeof(struct chunk_t));
+        char * chunk_fence2 = (((char *)arena -> heap.first_chunk) + move_to_data_block + arena -> heap.first_chunk -> size);
         for (int i = 0; i < fence_size; i++)
         {
-            if (fence[i] != *(chunk_fence + i)) {printf("First block left fence is incorrect\n"); return -2;}
-            if (fence[i] != *(chunk_fence2 + i)) {printf("First block right fence is incorrect\n"); return -2;}
+            if (fence[i] != *(chunk_fence + i)) {heap_message("First block left fence is incorrect\n"); return -2;}
+            if (fence[i] != *(chunk_fence2 + i)) {heap_message("First block right fence is incorrect\n"); return -2;}
         }
 
         //Validate next chunks and their fences
-        struct chunk_t * temp = myHeap.first_chunk -> next;
-        for (int i = 1; i < myHeap.chunk_count; i++)
+        struct chunk_t * prev = arena -> heap.first_chunk;
+        struct chunk_t * temp = chunk_next(arena -> heap.first_chunk);
+        for (int i = 1; i < arena -> heap.chunk_count; i++)
         {
             //Pointer check - shouldn't be NULL
             if (temp == NULL) 
             {
-                printf("Block %d is null\n", i);
+                heap_message("Block %d is null\n", i);
+                return -3;
+            }
+            if ((char *)temp < (char *)arena -> heap.heap || (char *)temp + metadata_size > (char *)arena -> heap.heap + arena -> heap.max_heap_size)
+            {
+                heap_message("Block %d lies outside of heap\n", i);
                 return -3;
             }
 
             //Metadata of chunks
-            if (temp -> size < 0) {printf("Block of ID: %d size is negative\n", i); return -3;}
-            if (temp -> taken_flag < 0 || temp -> taken_flag > 1) {printf("Taken flags of block: %d are incorrect\n", i); return -3;}
-            if (temp -> prev == NULL) {printf("Block of ID: %d prev pointer is NULL\n", i); return -3;}
-            if (temp -> next == NULL && (i != myHeap.chunk_count-1)) {printf("Block of ID: %d next pointer is NULL\n", i); return -3;}
-            if (temp -> next != (struct chunk_t *)next_block(temp)) 
+            if (temp -> size < 0) {heap_message("Block of ID: %d size is negative\n", i); return -3;}
+            if (temp -> taken_flag < 0 || temp -> taken_flag > CHUNK_CACHED) {heap_message("Taken flags of block: %d are incorrect\n", i); return -3;}
+            if (chunk_prev(temp) == NULL) {heap_message("Block of ID: %d prev pointer is NULL\n", i); return -3;}
+            if (chunk_next(temp) == NULL && (i != arena -> heap.chunk_count-1)) {heap_message("Block of ID: %d next pointer is NULL\n", i); return -3;}
+            if (chunk_next(temp) == NULL && (char *)next_block(temp) != (char *)arena -> heap.heap + arena -> heap.max_heap_size) {heap_message("Last block doesn't end at the end of heap\n"); return -3;}
+            if (chunk_next(temp) != NULL && chunk_next(temp) != (struct chunk_t *)next_block(temp)) 
             {
-                printf("Block next pointer is incorrect\n"); 
-                printf("Block of size: %lu and ID: %d\n", temp -> size, i);
-                printf("Temp -> next: %p\n", temp -> next);
-                printf("Temp -> next should be: %p\n", (struct chunk_t *)next_block(temp));
+                heap_message("Block next pointer is incorrect\n"); 
+                heap_message("Block of size: %lu and ID: %d\n", (unsigned long)temp -> size, i);
+                heap_message("Temp -> next: %p\n", chunk_next(temp));
+                heap_message("Temp -> next should be: %p\n", (struct chunk_t *)next_block(temp));
                 return -3;
             }
             
-            if (temp -> prev != (struct chunk_t *)prev_block(temp)) 
+            if (chunk_prev(temp) != prev) 
             {
-                printf("Block prev pointer is incorrect\n"); 
-                printf("Block of size: %lu and ID: %d\n", temp -> size, i);
-                printf("Temp -> prev: %p\n", temp -> prev);
-                printf("Temp -> prev should be: %p\n", (struct chunk_t *)prev_block(temp));
+                heap_message("Block prev pointer is incorrect\n"); 
+                heap_message("Block of size: %lu and ID: %d\n", (unsigned long)temp -> size, i);
+                heap_message("Temp -> prev: %p\n", chunk_prev(temp));
+                heap_message("Temp -> prev should be: %p\n", prev);
                 return -3;
             }
-            if (temp -> line < 0) {printf("Block line is negative\n"); return -3;}
-            if (temp -> filename == NULL) {printf("Block filename is NULL\n"); return -3;}
+#ifndef HEAP_COMPACT_HEADER
+            if (temp -> line < 0) {heap_message("Block line is negative\n"); return -3;}
+            if (temp -> filename == NULL) {heap_message("Block filename is NULL\n"); return -3;}
+#endif
 
             tempChecksum = temp -> checksum;
             temp -> checksum = 0;
-            if (tempChecksum != add_bytes(temp, sizeof(struct chunk_t))) {printf("Block checksum is incorrect\n"); return -3;}
+            if (tempChecksum != add_bytes(temp, sizeof(struct chunk_t))) {heap_message("Block checksum is incorrect\n"); return -3;}
             temp -> checksum = tempChecksum;
             
 
@@ -104,29 +219,148 @@ int heap_validate(void)
             
             for (int i = 0; i < fence_size; i++)
             {
-                if (fence[i] != *(chunk_fence + i)) {printf("Block left fence is incorrect\n"); return -3;}
-                if (fence[i] != *(chunk_fence2 + i)) {printf("Block right fence is incorrect\n"); return -3;}
+                if (fence[i] != *(chunk_fence + i)) {heap_message("Block left fence is incorrect\n"); return -3;}
+                if (fence[i] != *(chunk_fence2 + i)) {heap_message("Block right fence is incorrect\n"); return -3;}
             }
 
-            temp = temp -> next;
+            chunk_count_stats(temp, &counted);
+            prev = temp;
+            temp = chunk_next(temp);
         }
 
     }
+
+    //Counters kept by the operations have to match the blocks
+    struct heap_arena_stats_t kept;
+    arena_get_stats(arena, &kept);
+    if (kept.free_space != counted.free_space || kept.used_blocks_count != counted.used_blocks_count || kept.free_gaps_count != counted.free_gaps_count
+        || kept.largest_used_block_size != counted.largest_used_block_size || kept.largest_free_area != counted.largest_free_area)
+    {
+        heap_message("Heap statistics don't match the blocks\n");
+        return -1;
+    }
+    return 0;
+}
+
+int chunk_validate(struct arena_t * arena, struct chunk_t * chunk)
+{
+    //Checks a single chunk and its links to the neighbours, returns -3 like arena_validate
+    __atomic_add_fetch(&validationCount, 1, __ATOMIC_RELAXED);
+
+    int tempChecksum = chunk -> checksum;
+    chunk -> checksum = 0;
+    if (tempChecksum != add_bytes(chunk, sizeof(struct chunk_t))) {heap_message("Block checksum is incorrect\n"); return -3;}
+    chunk -> checksum = tempChecksum;
+
+    if (chunk -> taken_flag < 0 || chunk -> taken_flag > CHUNK_CACHED) {heap_message("Taken flags of block are incorrect\n"); return -3;}
+    if (chunk_prev(chunk) == NULL && chunk != arena -> heap.first_chunk) {heap_message("Block prev pointer is NULL\n"); return -3;}
+    if (chunk_prev(chunk) != NULL && chunk_next(chunk_prev(chunk)) != chunk) {heap_message("Block prev pointer is incorrect\n"); return -3;}
+    if (chunk_next(chunk) != NULL && (chunk_next(chunk) != (struct chunk_t *)next_block(chunk) || chunk_prev(chunk_next(chunk)) != chunk)) {heap_message("Block next pointer is incorrect\n"); return -3;}
+    if (chunk_next(chunk) == NULL && (char *)next_block(chunk) != (char *)arena -> heap.heap + arena -> heap.max_heap_size) {heap_message("Last block doesn't end at the end of heap\n"); return -3;}
+
+    char * chunk_fence = ((char *)chunk) + sizeof(struct chunk_t);
+    char * chunk_fence2 = ((char *)chunk) + move_to_data_block + chunk -> size;
+    for (int i = 0; i < fence_size; i++)
+    {
+        if (*(chunk_fence + i) != i) {heap_message("Block left fence is incorrect\n"); return -3;}
+        if (*(chunk_fence2 + i) != i) {heap_message("Block right fence is incorrect\n"); return -3;}
+    }
     return 0;
 }
 
+int validation_due(void)
+{
+    //Decides if the current operation walks the whole heap
+    switch (validationMode)
+    {
+        case validation_full: return 1;
+        case validation_sampled: return __atomic_add_fetch(&validationOperations, 1, __ATOMIC_RELAXED) % validationPeriod == 0;
+        default: return 0;
+    }
+}
+
+int heap_check(void)
+{
+    //Used by the public functions instead of heap_validate, never with an arena locked
+    if (!validation_due()) return 0;
+
+    uint64_t start = latency_start();
+    int res = heap_validate();
+    latency_record(latency_validate, start);
+    return res;
+}
+
+int arena_check(struct arena_t * arena)
+{
+    if (!validation_due()) return 0;
+
+    uint64_t start = latency_start();
+    int res = arena_validate(arena);
+    latency_record(latency_validate, start);
+    return res;
+}
+
+int chunk_check(struct arena_t * arena, struct chunk_t * chunk)
+{
+    if (validationMode != validation_local || chunk == NULL) return 0;
+
+    uint64_t start = latency_start();
+    int res = chunk_validate(arena, chunk);
+    latency_record(latency_validate, start);
+    return res;
+}
+
+void heap_set_validation_mode(enum validation_mode_t mode, int period)
+{
+    validationMode = mode;
+    if (period > 0) validationPeriod = period;
+}
+
+enum validation_mode_t heap_get_validation_mode(void)
+{
+    return validationMode;
+}
+
+uint64_t heap_get_validation_count(void)
+{
+    return __atomic_load_n(&validationCount, __ATOMIC_RELAXED);
+}
+
 int heap_reset(void)
 {
     if (heap_validate() < 0)
     {
-        printf("Heap_reset detected heap integrity breach\n");
+        heap_message("Heap_reset detected heap integrity breach\n");
         return -1;
     }
 
-    void * res = custom_sbrk(-myHeap.max_heap_size);
+    mapping_release_all();
+    profile_clear();
+    sample_clear();
+
+    //Every arena gives its memory back, the other arenas are set up again once a thread uses them
+    for (int i = 1; i < HEAP_MAX_ARENAS; i++)
+    {
+        struct arena_t * arena = &arenas[i];
+        if (arena -> heap.heap == NULL) continue;
+
+        pthread_mutex_lock(&arena -> lock);
+        if (arena_sbrk(arena, -arena -> heap.max_heap_size) == ((void *)-1))
+        {
+            heap_message("Heap reset failed at resetting arena %d\n", i);
+            pthread_mutex_unlock(&arena -> lock);
+            return -1;
+        }
+        arena -> heap.heap = NULL;
+        memset(arena -> remote_frees, 0, sizeof(arena -> remote_frees));
+        arena -> remote_free_count = 0;
+        pthread_mutex_unlock(&arena -> lock);
+    }
+
+    void * res = arena_sbrk(&arenas[0], -arenas[0].heap.max_heap_size);
     if (res == ((void *)-1)) 
     {
-        printf("Heap reset failed at resetting the heap\n");
+        heap_message("Heap reset failed at resetting the heap\n");
         return -1;
     }
     if (heap_setup() < 0) return -1;
@@ -136,951 +370,4062 @@ int heap_reset(void)
 
 int heap_setup(void)
 {
-    //Init firstChunk
-    firstChunk.prev = NULL;
-    firstChunk.next = NULL;
-    firstChunk.size = PAGE_SIZE * 2 - metadata_size;
-    firstChunk.taken_flag = 0;
-    firstChunk.line = __LINE__;
-    firstChunk.filename = __FILE__;
-    firstChunk.checksum = 0;
-    firstChunk.checksum = add_bytes(&firstChunk, sizeof(firstChunk));
-    //Init myHeap
-    myHeap.max_heap_size = PAGE_SIZE * 2;
-    myHeap.heap = custom_sbrk(PAGE_SIZE * 2);
-    if (myHeap.heap == ((void *)-1))
+    heapGeneration++;
+    return arena_setup(&arenas[0]);
+}
+
+int arena_reset(struct arena_t * arena)
+{
+    if (arena_check(arena) < 0)
     {
-        printf("Heap setup failed at requesting initial memory from OS\n");
+        heap_message("Arena reset detected heap integrity breach\n");
         return -1;
     }
 
-    myHeap.chunk_count = 0;
-    myHeap.first_chunk = myHeap.heap;
-    
-    myHeap.checksum = 0;
-    myHeap.checksum = add_bytes(&myHeap, sizeof(myHeap));
-    memcpy(myHeap.heap, &firstChunk, sizeof(firstChunk));
-
-    //Check for heap integrity
-    int res = 0;
-    if ((res = heap_validate()) < 0)
+    size_t returned = arena -> heap.max_heap_size;
+    void * res = arena_sbrk(arena, -arena -> heap.max_heap_size);
+    if (res == ((void *)-1)) 
     {
-        printf("Heap setup failed at assuring heap integrity: %d\n", res);
+        heap_message("Heap reset failed at resetting the heap\n");
         return -1;
     }
+    if (arena_setup(arena) < 0) return -1;
 
+    __atomic_add_fetch(&trimmedBytes, returned - arena -> heap.max_heap_size, __ATOMIC_RELAXED);
     return 0;
 }
 
-uint32_t add_bytes(void * ptr, uint32_t data_size)
+size_t arena_trim(struct arena_t * arena, size_t pad)
 {
-    if (!ptr || data_size < 1) return 0;
+    //Shrinks a free block at the end of the arena to at least pad bytes and moves the break back
+    //Returns the number of bytes given back, the caller holds the arena lock
+    struct chunk_t * last = heap_get_last_block(arena);
+    if (last -> taken_flag || last -> size <= pad) return 0;
 
-    uint32_t sum = 0;
-    for (uint32_t i = 0; i < data_size; i++)
+    size_t excess = (last -> size - pad) / PAGE_SIZE * PAGE_SIZE;
+    if (arena -> heap.max_heap_size - excess < PAGE_SIZE * 2) excess = (arena -> heap.max_heap_size - PAGE_SIZE * 2) / PAGE_SIZE * PAGE_SIZE;
+    if (excess == 0) return 0;
+
+    if (arena_sbrk(arena, -(intptr_t)excess) == ((void *)-1))
     {
-        sum += (*(((unsigned char *)ptr) + i));
+        heap_message("Heap trim failed at giving memory back to OS\n");
+        return 0;
     }
 
-    return sum;
+    bin_remove(arena, last);
+    last -> size -= excess;
+    last -> checksum = 0;
+    last -> checksum = add_bytes(last, sizeof(struct chunk_t));
+    bin_insert(arena, last);
+    for (int i = 0; i < fence_size; i++)
+    {
+        *((char *)last + move_to_data_block + last -> size + i) = i;
+    }
+
+    arena -> heap.max_heap_size -= excess;
+    arena -> heap.checksum = 0;
+    arena -> heap.checksum = add_bytes(&arena -> heap, sizeof(heap));
+
+    __atomic_add_fetch(&trimmedBytes, excess, __ATOMIC_RELAXED);
+    return excess;
 }
 
-struct chunk_t * find_suitable_block(uint32_t needed_space)
+size_t heap_trim(size_t pad)
 {
-    struct chunk_t * temp = myHeap.first_chunk;
-
-    //First look for suitable freed blocks in the heap
-    int suitable_block_found = 0;
-    while (temp)
+    //Trims every arena so at most pad free bytes stay at its end, returns the bytes given back
+    size_t returned = 0;
+    for (int i = 0; i < HEAP_MAX_ARENAS; i++)
     {
-        //This block is perfect and no need to split
-        if (temp -> size == needed_space && !(temp -> taken_flag))
-        {
-            suitable_block_found = 1;
-            break;
-        }
-
-        //This block can be used but should be splitted
-        if ((temp -> size >= (needed_space + metadata_size)) && (temp -> taken_flag == 0))
-        {
-            split(temp, needed_space);
+        struct arena_t * arena = &arenas[i];
+        if (arena -> heap.heap == NULL) continue;
 
-            suitable_block_found = 1;
-            break;
-        }
-        temp = temp -> next;
+        arena_lock(arena);
+        if (arena -> heap.heap != NULL && arena_check(arena) == 0) returned += arena_trim(arena, pad);
+        pthread_mutex_unlock(&arena -> lock);
     }
-
-    if (!suitable_block_found) temp = NULL;
-    return temp;
+    return returned;
 }
 
-struct chunk_t * heap_get_last_block()
+void heap_set_trim_threshold(size_t bytes)
 {
-    struct chunk_t * last_block = myHeap.first_chunk;
-    while (last_block)
-    {
-        if (last_block -> next == NULL) break;
-        last_block = last_block -> next; 
-    }
-    return last_block;
+    trimThreshold = bytes;
 }
 
-size_t page_size(size_t number)
+uint64_t heap_get_trimmed_bytes(void)
 {
-    size_t multiple = PAGE_SIZE;
-    return ((number + multiple - 1) / multiple) * multiple;
+    return __atomic_load_n(&trimmedBytes, __ATOMIC_RELAXED);
 }
 
-int coalesce_blocks(struct chunk_t * temp)
+int arena_setup(struct arena_t * arena)
 {
-    if (!temp) return 0;
-    
-    struct chunk_t * right = temp -> next;
+    read_environment();
 
-    if (get_pointer_type(right) == pointer_control_block)
+    //Init firstChunk
+    struct chunk_t firstChunk;
+    memset(&firstChunk, 0, sizeof(firstChunk));
+    chunk_set_prev(&firstChunk, NULL);
+    chunk_set_next(&firstChunk, NULL);
+    firstChunk.size = PAGE_SIZE * 2 - metadata_size;
+    firstChunk.taken_flag = 0;
+    firstChunk.slab_flag = 0;
+    chunk_init_site(&firstChunk);
+    firstChunk.checksum = 0;
+    firstChunk.checksum = add_bytes(&firstChunk, sizeof(firstChunk));
+    //Init arena heap
+    memset(arena -> remote_frees, 0, sizeof(arena -> remote_frees));
+    arena -> remote_free_count = 0;
+    arena -> heap.max_heap_size = PAGE_SIZE * 2;
+    arena -> heap.heap = arena_sbrk(arena, PAGE_SIZE * 2);
+    if (arena -> heap.heap == ((void *)-1))
     {
-        if (right -> taken_flag == 0)
-        {
-            //Time to coalesce
-            if (right -> next)
-            {
-                right -> next -> prev = temp;
-                right -> next -> checksum = 0;
-                right -> next -> checksum = add_bytes(right -> next, sizeof(struct chunk_t));
-            }
-            temp -> next = right -> next;
-            temp -> size += (right -> size + metadata_size);
-            temp -> checksum = 0;
-            temp -> checksum = add_bytes(temp, sizeof(struct chunk_t));
-
-            myHeap.chunk_count--;
-            myHeap.checksum = 0;
-            myHeap.checksum = add_bytes(&myHeap, sizeof(myHeap));
-        }
+        heap_message("Heap setup failed at requesting initial memory from OS\n");
+        arena -> heap.heap = NULL;
+        return -1;
     }
-    else printf("Coalesce blocks didnt get pointer_control_block\n");
-    return 1;
-}
 
-void split(struct chunk_t * temp, size_t bytes)
-{
-    struct chunk_t * right = temp -> next;
+    arena -> heap.chunk_count = 1;
+    arena -> heap.first_chunk = arena -> heap.heap;
+    
+    arena -> heap.checksum = 0;
+    arena -> heap.checksum = add_bytes(&arena -> heap, sizeof(heap));
+    memcpy(arena -> heap.heap, &firstChunk, sizeof(firstChunk));
 
-    //calculate new size for the new block
-    int size_of_new_block = temp -> size - bytes - metadata_size;
-    //update size of the fitting block
-    temp -> size = bytes;
-    temp -> checksum = 0;
-    temp -> checksum = add_bytes(temp, sizeof(struct chunk_t));
-    //memcpy fence at the end of fitting block
     char fence[fence_size];
     for (int i = 0; i < fence_size; i++)
     {
         fence[i] = i;
     }
+    memcpy((char *)arena -> heap.heap + sizeof(struct chunk_t), fence, sizeof(fence));
+    memcpy((char *)arena -> heap.heap + move_to_data_block + firstChunk.size, fence, sizeof(fence));
+
+    //The whole heap starts as one free block
+    memset(arena -> free_bins, 0, sizeof(arena -> free_bins));
+    arena -> free_bins_map = 0;
+    size_index_clear(&arena -> free_sizes);
+    size_index_clear(&arena -> used_sizes);
+    arena -> placement = placementPolicy;
+    free_tree_clear(&arena -> free_tree, placementPolicy == placement_best_fit);
+    arena -> rover = NULL;
+    arena -> slab_free_space = 0;
+    arena -> free_gaps_count = 0;
+    bin_insert(arena, arena -> heap.first_chunk);
+    page_map_clear(arena);
+    page_map_add(arena, arena -> heap.first_chunk);
+    memset(arena -> slabs, 0, sizeof(arena -> slabs));
+    site_table_clear(arena);
 
-    memcpy(((char *)temp) + sizeof(struct chunk_t), fence, sizeof(fence));
-    memcpy(((char *)temp) + temp -> size + move_to_data_block, fence, sizeof(fence));
-    //create newblock with the remaining size
-    struct chunk_t newBlock;
+    //Check for heap integrity
+    int res = 0;
+    if ((res = arena_validate(arena)) < 0)
+    {
+        heap_message("Heap setup failed at assuring heap integrity: %d\n", res);
+        return -1;
+    }
 
-    newBlock.prev = temp;
-    newBlock.next = right;
-    newBlock.size = size_of_new_block;
-    newBlock.taken_flag = 0;
-    newBlock.line = __LINE__;
-    newBlock.filename = __FILE__;
-    newBlock.checksum = 0;
-    newBlock.checksum = add_bytes(&newBlock, sizeof(struct chunk_t));
-    
-    myHeap.chunk_count++;
-    myHeap.checksum = 0;
-    myHeap.checksum = add_bytes(&myHeap, sizeof(myHeap));
+    return 0;
+}
 
-    temp -> next = (struct chunk_t *)next_block(temp);
-    temp -> next -> checksum = 0;
-    temp -> next -> checksum = add_bytes(temp -> next, sizeof(struct chunk_t));
-    if (right) right -> prev = temp -> next;
-    memcpy(temp -> next, &newBlock, sizeof(newBlock));
+void read_environment(void)
+{
+    static int environment_read = 0;
+    if (environment_read) return;
+    environment_read = 1;
 
-    //set left fence of newblock as right doesnt need to be changed
-    memcpy(((char *)temp -> next + sizeof(struct chunk_t)), fence, sizeof(fence));
+    const char * env = getenv("HEAP_TCACHE");
+    if (env) threadCacheEnabled = atoi(env) != 0;
 
-    //update checksum of all blocks changed or created
-    temp -> checksum = 0;
-    temp -> checksum = add_bytes(temp, sizeof(struct chunk_t));
+    env = getenv("HEAP_SLAB");
+    if (env) slabEnabled = atoi(env) != 0;
 
-    if (right)
+    env = getenv("HEAP_REMOTE_FREE");
+    if (env) remoteFreeEnabled = atoi(env) != 0;
+
+    env = getenv("HEAP_MMAP_THRESHOLD");
+    if (env) mmapThreshold = strtoull(env, NULL, 10);
+
+    env = getenv("HEAP_TRIM_THRESHOLD");
+    if (env) trimThreshold = strtoull(env, NULL, 10);
+
+    env = getenv("HEAP_MESSAGES");
+    if (env) messagesEnabled = atoi(env) != 0;
+
+    env = getenv("HEAP_LATENCY");
+    if (env) latencyEnabled = atoi(env) != 0;
+
+    env = getenv("HEAP_PROFILE");
+    if (env) profileEnabled = atoi(env) != 0;
+
+    env = getenv("HEAP_SAMPLE_INTERVAL");
+    if (env) sampleInterval = strtoull(env, NULL, 10);
+
+    env = getenv("HEAP_SITES");
+    if (env) siteTableEnabled = atoi(env) != 0;
+
+    env = getenv("HEAP_VALIDATE");
+    if (env)
     {
-        right -> checksum = 0;
-        right -> checksum = add_bytes(right, sizeof(struct chunk_t));
+        if (strcmp(env, "off") == 0) validationMode = validation_off;
+        else if (strcmp(env, "sampled") == 0) validationMode = validation_sampled;
+        else if (strcmp(env, "local") == 0) validationMode = validation_local;
+        else if (strcmp(env, "full") == 0) validationMode = validation_full;
     }
-}
 
-size_t get_payload_size(void * ptr)
-{
-    if (get_pointer_type(ptr) == pointer_valid)
+    env = getenv("HEAP_PLACEMENT");
+    if (env)
     {
-        struct chunk_t * block = heap_get_data_block_start(ptr);
-        return block -> size;
+        if (strcmp(env, "good") == 0) placementPolicy = placement_good_fit;
+        else if (strcmp(env, "first") == 0) placementPolicy = placement_first_fit;
+        else if (strcmp(env, "next") == 0) placementPolicy = placement_next_fit;
+        else if (strcmp(env, "best") == 0) placementPolicy = placement_best_fit;
     }
 
-    return 0;
+    env = getenv("HEAP_VALIDATE_PERIOD");
+    if (env && atoi(env) > 0) validationPeriod = atoi(env);
+
+    env = getenv("HEAP_ARENAS");
+    if (env) heap_set_arena_count(atoi(env));
+    if (arenaCount == 0) heap_set_arena_count(sysconf(_SC_NPROCESSORS_ONLN));
 }
 
-void heap_free(void * ptr)
+void heap_set_arena_count(int count)
 {
-    pthread_mutex_lock(&myMutex);
-    if (get_pointer_type(ptr) == pointer_valid)
-    {
-        struct chunk_t * temp = (struct chunk_t *)(((char *)ptr) - (move_to_data_block));
-        if (get_pointer_type(temp) != pointer_control_block)
-        {
-            printf("Invalid pointer passed to heap_free\n");
-        }
-        temp -> taken_flag = 0;
-        temp -> checksum = 0;
-        temp -> checksum = add_bytes(temp, sizeof(struct chunk_t));
+    //Only threads which didn't allocate yet are spread over the new count
+    if (count < 1) count = 1;
+    if (count > HEAP_MAX_ARENAS) count = HEAP_MAX_ARENAS;
+    arenaCount = count;
+}
 
-        //Coalesce free blocks if such exist next to each other
-        if (temp -> prev && temp -> prev -> taken_flag == 0)
-        {
-            temp = temp -> prev;
-            coalesce_blocks(temp);
-        }
+int heap_get_arena_count(void)
+{
+    return arenaCount;
+}
 
-        if (temp -> next && temp -> next -> taken_flag == 0) 
-        {
-            coalesce_blocks(temp);
-        }
+void * arena_sbrk(struct arena_t * arena, intptr_t delta)
+{
+    if (arena == &arenas[0]) return custom_sbrk(delta);
 
-        if (heap_get_used_blocks_count() == 0)
+    //Other arenas move their own break inside the reserved mapping
+    if (arena -> reserve == NULL)
+    {
+        arena -> reserve = mmap(NULL, ARENA_RESERVE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (arena -> reserve == MAP_FAILED)
         {
-            if (heap_reset() < 0)
-            {
-                printf("Couldn't reset heap!\n");
-            }
+            arena -> reserve = NULL;
+            return (void *)-1;
         }
+        arena -> reserve_used = 0;
     }
-    else
+
+    if ((intptr_t)arena -> reserve_used + delta < 0 || arena -> reserve_used + delta > ARENA_RESERVE_SIZE) return (void *)-1;
+
+    void * old_break = (char *)arena -> reserve + arena -> reserve_used;
+    arena -> reserve_used += delta;
+    if (delta < 0) madvise((char *)arena -> reserve + arena -> reserve_used, -delta, MADV_DONTNEED);
+    return old_break;
+}
+
+void arena_lock(struct arena_t * arena)
+{
+    uint64_t start = latency_start();
+    if (pthread_mutex_trylock(&arena -> lock) != 0)
     {
-        printf("Invalid pointer passed to heap_free!\n");
-        printf("Passed pointer: %p\n", ptr);
+        //Counted before the lock is taken, so waiting threads add at the same time
+        __atomic_add_fetch(&arena -> contention, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&arena -> lock);
     }
-    pthread_mutex_unlock(&myMutex);
+    latency_record(latency_lock_wait, start);
+
+    //Whoever takes the lock next gives back the blocks other threads left in the queue
+    remote_free_drain(arena);
 }
 
-void heap_dump_debug_information(void)
+struct arena_t * arena_of(const void * pointer)
 {
-    if (heap_validate() < 0)
+    //Arenas never overlap so the address range tells which arena owns a pointer
+    for (int i = 0; i < HEAP_MAX_ARENAS; i++)
     {
-        printf("Detected heap integrity breach in heap_dump_debug_information\n");
-        return;
+        struct arena_t * arena = &arenas[i];
+        char * start = (char *)arena -> heap.heap;
+        if (start == NULL) continue;
+        if ((char *)pointer >= start && (char *)pointer <= start + arena -> heap.max_heap_size) return arena;
     }
+    return NULL;
+}
 
-    int chunk_counter = 0;
-    struct chunk_t * temp = myHeap.first_chunk;
-
-    printf("################################\n");
-    printf("HEAP STRUCT INFORMATION DUMP:\n");
-    printf("HEAP ADDRESS: %p\n", myHeap.heap);
-    printf("HEAP FIRST_CHUNK ADDRESS: %p\n", myHeap.first_chunk);
-    printf("HEAP CHECKSUM: %d\n", myHeap.checksum);
-    printf("HEAP CURRENT FREE SIZE: %lu\n", heap_get_free_space());
-    printf("HEAP MAX SIZE: %lu\n", myHeap.max_heap_size);
-    printf("HEAP CHUNKS IN USE: %lu\n", myHeap.chunk_count);
-    printf("HEAP MAX ADDRESS: %p\n", (void *)((char *)myHeap.heap + myHeap.max_heap_size));
-    printf("HEAP BIGGEST BLOCK: %lu\n", heap_get_largest_used_block_size());
-    printf("################################\n");
-    
-    printf("\n");
-    
-    printf("################################\n");
-    printf("HEAP CHUNKS INFORMATION:\n");
+struct arena_t * thread_arena(void)
+{
+    if (threadArena) return threadArena;
 
-    while (temp)
+    //New threads go to the arena with the fewest threads, ties go to the least contended one
+    read_environment();
+    pthread_mutex_lock(&arenasMutex);
+    struct arena_t * best = &arenas[0];
+    for (int i = 1; i < arenaCount; i++)
     {
-        printf("----------------------------------------\n");
-        printf("CHUNK NUMBER: %d\n", chunk_counter);
-        printf("CHUNK ADDRESS: %p\n", temp);
-        printf("CHUNK PREV ADDRESS: %p\n", temp -> prev);
-        printf("CHUNK NEXT ADDRESS: %p\n", temp -> next);
-        printf("CHUNK CHECKSUM: %d\n", temp -> checksum);
-        printf("CHUNK PAYLOAD SIZE: %lu\n", temp -> size);
-        printf("CHUNK ACTUAL SIZE: %lu\n", temp -> size + metadata_size);
-        printf("CHUNK TAKEN FLAG: %d\n", temp -> taken_flag);
-        printf("CHUNK ALLOCATED IN LINE: %d\n", temp -> line);
-        printf("CHUNK ALLOCATED IN FILE: %s\n", temp -> filename);
-        printf("----------------------------------------\n");
-        printf("\n");
-        temp = temp -> next;
-        chunk_counter++;
+        struct arena_t * arena = &arenas[i];
+        if (arena -> threads < best -> threads || (arena -> threads == best -> threads && __atomic_load_n(&arena -> contention, __ATOMIC_RELAXED) < __atomic_load_n(&best -> contention, __ATOMIC_RELAXED))) best = arena;
     }
-    
-    printf("END OF CHUNKS\n");
-    printf("################################\n");
+    best -> threads++;
+    pthread_mutex_unlock(&arenasMutex);
+
+    threadArena = best;
+    thread_register();
+    return best;
 }
 
-void * heap_malloc_debug(size_t bytes, int line, const char * filename)
+struct arena_t * lock_thread_arena(void)
 {
-    pthread_mutex_lock(&myMutex);
-    //Malloc code here with bonus information about blocks allocated or failures
-    if (!bytes) 
+    //Returns the locked arena of the calling thread, arenas other than the first are set up on first use
+    struct arena_t * arena = thread_arena();
+    arena_lock(arena);
+    if (arena -> heap.heap == NULL && arena != &arenas[0] && arena_setup(arena) < 0)
     {
-        printf("Called malloc with 0 amount of bytes\n");
-        printf("Malloc called in line: %d\nAnd filename: %s\n", line, filename);        
-        pthread_mutex_unlock(&myMutex);
+        pthread_mutex_unlock(&arena -> lock);
         return NULL;
     }
+    return arena;
+}
+
+uint32_t add_bytes(void * ptr, uint32_t data_size)
+{
+    //Integrity code of headers, CRC32C computed by the kernel picked for this CPU
+    if (!ptr || data_size < 1) return 0;
+
+    return checksumKernel(ptr, data_size);
+}
 
-    if (bytes + sizeof(struct chunk_t) < bytes)
+uint32_t byte_sum(const void * ptr, uint32_t data_size)
+{
+    //Checksum used before CRC32C, kept for comparison in the benchmarks
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < data_size; i++)
     {
-        printf("Called malloc with negative amount of bytes\n");
-        printf("Malloc called in line: %d\nAnd filename: %s\n", line, filename);        
-        pthread_mutex_unlock(&myMutex);
-        return NULL;
+        sum += (*(((unsigned char *)ptr) + i));
     }
 
-    if (heap_validate() < 0)
+    return sum;
+}
+
+uint32_t checksum_select(const void * ptr, uint32_t data_size)
+{
+    //Runs once, every later checksum goes straight to the chosen kernel
+    for (uint32_t i = 0; i < 256; i++)
     {
-        printf("Detected heap integrity breach\n");
-        printf("Malloc called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
-        return NULL;
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+        crc32cTable[0][i] = crc;
     }
-
-    //Add a new block of requested size to the heap and return pointer to the data block
-    char fence[fence_size];
-    for (int i = 0; i < fence_size; i++)
+    for (uint32_t i = 0; i < 256; i++)
     {
-        fence[i] = i;
+        for (int k = 1; k < 8; k++) crc32cTable[k][i] = (crc32cTable[k - 1][i] >> 8) ^ crc32cTable[0][crc32cTable[k - 1][i] & 0xff];
     }
 
-    //Function returns a freed block of at least required space if such exists
-    //It is also responsible for splitting blocks
+    checksumKernel = crc32c_portable;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) checksumKernel = crc32c_sse42;
+#endif
+    return checksumKernel(ptr, data_size);
+}
 
-    struct chunk_t * suitableBlock;
-    suitableBlock = find_suitable_block(bytes);
-    
-    //If NULL was returned we failed to find a suitable block
-    //Check if we have enough space to push the block at the "end" of the heap
-    //If not ask OS for more memory and put the block there
-    if (suitableBlock == NULL && myHeap.chunk_count > 0)
+uint32_t crc32c_portable(const void * ptr, uint32_t data_size)
+{
+    const unsigned char * bytes = ptr;
+    uint32_t crc = ~(uint32_t)0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; data_size >= 8; data_size -= 8, bytes += 8)
     {
-        struct chunk_t * last_block = heap_get_last_block();
-        
-        if (((char *)myHeap.heap + myHeap.max_heap_size) - ((char *)last_block + last_block -> size) <= (bytes + metadata_size))
-        {
-            void * res = custom_sbrk(page_size(bytes + metadata_size));
-            if (res == ((void *)-1))
-            {
-                printf("Couldn't request more memory from OS\n");
-                printf("Malloc called in line: %d\nAnd filename: %s\n", line, filename);
-                pthread_mutex_unlock(&myMutex);
-                return NULL;
-            }
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        word ^= crc;
+        crc = crc32cTable[7][word & 0xff] ^ crc32cTable[6][(word >> 8) & 0xff] ^
+              crc32cTable[5][(word >> 16) & 0xff] ^ crc32cTable[4][(word >> 24) & 0xff] ^
+              crc32cTable[3][(word >> 32) & 0xff] ^ crc32cTable[2][(word >> 40) & 0xff] ^
+              crc32cTable[1][(word >> 48) & 0xff] ^ crc32cTable[0][word >> 56];
+    }
+#endif
+    for (; data_size > 0; data_size--, bytes++)
+    {
+        crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *bytes) & 0xff];
+    }
+    return ~crc;
+}
 
-            myHeap.max_heap_size += page_size(bytes + metadata_size);
-            myHeap.checksum = 0;
-            myHeap.checksum = add_bytes(&myHeap, sizeof(myHeap));
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t crc32c_sse42(const void * ptr, uint32_t data_size)
+{
+    const unsigned char * bytes = ptr;
+    uint64_t crc = ~(uint32_t)0;
+    for (; data_size >= 8; data_size -= 8, bytes += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        crc = _mm_crc32_u64(crc, word);
+    }
+    for (; data_size > 0; data_size--, bytes++)
+    {
+        crc = _mm_crc32_u8((uint32_t)crc, *bytes);
+    }
+    return ~(uint32_t)crc;
+}
+#endif
+
+size_t bin_index(size_t size)
+{
+    //Blocks under 64 bytes get a bin per 8 bytes
+    //Bigger ones get 4 bins per power of two, everything past 1MB lands in the last bin
+    if (size < 64) return size >> 3;
+
+    int log = 63 - __builtin_clzl(size);
+    size_t index = 8 + (log - 6) * 4 + ((size >> (log - 2)) & 3);
+    return index < BIN_COUNT ? index : BIN_COUNT - 1;
+}
+
+void bin_insert(struct arena_t * arena, struct chunk_t * chunk)
+{
+    //Every free block passes here, so the statistics of free blocks are kept up to date here as well
+    size_index_add(&arena -> free_sizes, chunk -> size);
+    if (chunk -> size >= FREE_GAP_MIN_SIZE) arena -> free_gaps_count++;
+
+    //Free blocks too small to hold the links stay out of the bins until they merge with a neighbour
+    if (!chunk_binnable(chunk)) return;
+    if (arena -> placement != placement_good_fit) free_tree_insert(&arena -> free_tree, chunk);
+
+    size_t index = bin_index(chunk -> size);
+    struct chunk_t * head = arena -> free_bins[index];
+
+    chunk_prev_free(chunk) = NULL;
+    chunk_next_free(chunk) = head;
+    chunk -> checksum = 0;
+    chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
+
+    if (head)
+    {
+        chunk_prev_free(head) = chunk;
+        head -> checksum = 0;
+        head -> checksum = add_bytes(head, sizeof(struct chunk_t));
+    }
+
+    arena -> free_bins[index] = chunk;
+    arena -> free_bins_map |= (uint64_t)1 << index;
+}
+
+void bin_remove(struct arena_t * arena, struct chunk_t * chunk)
+{
+    size_index_remove(&arena -> free_sizes, chunk -> size);
+    if (chunk -> size >= FREE_GAP_MIN_SIZE) arena -> free_gaps_count--;
+
+    if (!chunk_binnable(chunk)) return;
+    if (arena -> placement != placement_good_fit) free_tree_remove(&arena -> free_tree, chunk);
+
+    size_t index = bin_index(chunk -> size);
+    struct chunk_t * prev_free = chunk_prev_free(chunk);
+    struct chunk_t * next_free = chunk_next_free(chunk);
+
+    if (prev_free)
+    {
+        chunk_next_free(prev_free) = next_free;
+        prev_free -> checksum = 0;
+        prev_free -> checksum = add_bytes(prev_free, sizeof(struct chunk_t));
+    }
+    else arena -> free_bins[index] = next_free;
+
+    if (next_free)
+    {
+        chunk_prev_free(next_free) = prev_free;
+        next_free -> checksum = 0;
+        next_free -> checksum = add_bytes(next_free, sizeof(struct chunk_t));
+    }
+
+    if (arena -> free_bins[index] == NULL) arena -> free_bins_map &= ~((uint64_t)1 << index);
+
+    chunk_next_free(chunk) = NULL;
+    chunk_prev_free(chunk) = NULL;
+    chunk -> checksum = 0;
+    chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
+}
+
+struct chunk_t ** page_map_slot(struct arena_t * arena, const void * address, int create)
+{
+    //Two level map indexed by the page number inside the arena
+    size_t page = ((char *)address - (char *)arena -> heap.heap) / PAGE_SIZE;
+    size_t root = page >> PAGE_MAP_LEAF_BITS;
+    if (root >= PAGE_MAP_ROOT_SIZE) return NULL;
+
+    if (arena -> page_map[root] == NULL)
+    {
+        if (!create) return NULL;
+
+        void * leaf = mmap(NULL, sizeof(struct page_leaf_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (leaf == MAP_FAILED) return NULL;
+        arena -> page_map[root] = leaf;
+    }
+
+    return &arena -> page_map[root] -> chunks[page & ((1 << PAGE_MAP_LEAF_BITS) - 1)];
+}
+
+void page_map_mark(struct arena_t * arena, const void * address, int used)
+{
+    //Keeps the bitmaps of the leaf and of the root in step with the slot of the page
+    size_t page = ((char *)address - (char *)arena -> heap.heap) / PAGE_SIZE;
+    size_t root = page >> PAGE_MAP_LEAF_BITS;
+    size_t index = page & ((1 << PAGE_MAP_LEAF_BITS) - 1);
+    struct page_leaf_t * leaf = arena -> page_map[root];
+
+    if (used)
+    {
+        leaf -> used[index / 64] |= (uint64_t)1 << (index % 64);
+        leaf -> summary |= (uint64_t)1 << (index / 64);
+        arena -> page_map_leaves[root / 64] |= (uint64_t)1 << (root % 64);
+        arena -> page_map_summary |= (uint64_t)1 << (root / 64);
+        return;
+    }
+
+    leaf -> used[index / 64] &= ~((uint64_t)1 << (index % 64));
+    if (leaf -> used[index / 64]) return;
+    leaf -> summary &= ~((uint64_t)1 << (index / 64));
+    if (leaf -> summary) return;
+    arena -> page_map_leaves[root / 64] &= ~((uint64_t)1 << (root % 64));
+    if (arena -> page_map_leaves[root / 64]) return;
+    arena -> page_map_summary &= ~((uint64_t)1 << (root / 64));
+}
+
+void page_map_add(struct arena_t * arena, struct chunk_t * chunk)
+{
+    //Every page remembers only the lowest chunk header starting inside of it
+    struct chunk_t ** slot = page_map_slot(arena, chunk, 1);
+    if (slot == NULL)
+    {
+        heap_message("Page map couldn't get memory for a new leaf\n");
+        return;
+    }
+    if (*slot == NULL) page_map_mark(arena, chunk, 1);
+    if (*slot == NULL || chunk < *slot) *slot = chunk;
+}
+
+void page_map_remove(struct arena_t * arena, struct chunk_t * chunk)
+{
+    //Has to be called while the chunk still links to the following chunk
+    struct chunk_t ** slot = page_map_slot(arena, chunk, 0);
+    if (slot == NULL || *slot != chunk) return;
+
+    struct chunk_t * next = chunk_next(chunk);
+    if (next && page_map_slot(arena, next, 0) == slot) *slot = next;
+    else
+    {
+        *slot = NULL;
+        page_map_mark(arena, chunk, 0);
+    }
+}
+
+void page_map_clear(struct arena_t * arena)
+{
+    for (int i = 0; i < PAGE_MAP_ROOT_SIZE; i++)
+    {
+        if (arena -> page_map[i]) memset(arena -> page_map[i], 0, sizeof(struct page_leaf_t));
+    }
+    memset(arena -> page_map_leaves, 0, sizeof(arena -> page_map_leaves));
+    arena -> page_map_summary = 0;
+}
+
+int64_t page_map_previous(struct arena_t * arena, size_t page)
+{
+    //Returns the highest page below page which has a chunk, -1 when there is none
+    //Every level is a word of bits, so the search takes a few bit scans whatever the distance
+    size_t root = page >> PAGE_MAP_LEAF_BITS;
+    size_t index = page & ((1 << PAGE_MAP_LEAF_BITS) - 1);
+    struct page_leaf_t * leaf = root < PAGE_MAP_ROOT_SIZE ? arena -> page_map[root] : NULL;
+
+    if (leaf)
+    {
+        uint64_t bits = leaf -> used[index / 64] & (((uint64_t)1 << (index % 64)) - 1);
+        if (bits) return (root << PAGE_MAP_LEAF_BITS) + index / 64 * 64 + 63 - __builtin_clzll(bits);
+
+        uint64_t words = leaf -> summary & (((uint64_t)1 << (index / 64)) - 1);
+        if (words)
+        {
+            size_t word = 63 - __builtin_clzll(words);
+            return (root << PAGE_MAP_LEAF_BITS) + word * 64 + 63 - __builtin_clzll(leaf -> used[word]);
+        }
+    }
+
+    //Highest leaf below the leaf of the page, then its highest page
+    int64_t below = -1;
+    uint64_t leaves = root < PAGE_MAP_ROOT_SIZE ? arena -> page_map_leaves[root / 64] & (((uint64_t)1 << (root % 64)) - 1) : 0;
+    uint64_t words = root < PAGE_MAP_ROOT_SIZE ? arena -> page_map_summary & (((uint64_t)1 << (root / 64)) - 1) : arena -> page_map_summary;
+    if (leaves) below = root / 64 * 64 + 63 - __builtin_clzll(leaves);
+    else if (words)
+    {
+        size_t word = 63 - __builtin_clzll(words);
+        below = word * 64 + 63 - __builtin_clzll(arena -> page_map_leaves[word]);
+    }
+    if (below < 0) return -1;
+
+    leaf = arena -> page_map[below];
+    size_t word = 63 - __builtin_clzll(leaf -> summary);
+    return ((size_t)below << PAGE_MAP_LEAF_BITS) + word * 64 + 63 - __builtin_clzll(leaf -> used[word]);
+}
+
+struct chunk_t * page_map_find(struct arena_t * arena, const void * address)
+{
+    //Returns the chunk whose header, fences or data hold the address
+    //It is the last chunk starting at or before the address: the lowest chunk of the page of the address
+    //when it starts early enough, otherwise the last chunk of the nearest page before it which has one
+    size_t page = ((char *)address - (char *)arena -> heap.heap) / PAGE_SIZE;
+    struct chunk_t ** slot = page_map_slot(arena, address, 0);
+    struct chunk_t * chunk = slot && *slot && (char *)*slot <= (char *)address ? *slot : NULL;
+    if (chunk == NULL)
+    {
+        int64_t previous = page_map_previous(arena, page);
+        if (previous < 0) return NULL;
+        chunk = arena -> page_map[previous >> PAGE_MAP_LEAF_BITS] -> chunks[previous & ((1 << PAGE_MAP_LEAF_BITS) - 1)];
+    }
+
+    //Only chunks of a single page can be passed on the way
+    while (chunk_next(chunk) && (char *)chunk_next(chunk) <= (char *)address) chunk = chunk_next(chunk);
+    return chunk;
+}
+
+size_t site_slot(const struct site_table_t * table, const void * chunk)
+{
+    uint64_t hash = ((uintptr_t)chunk >> 4) * 0x9E3779B97F4A7C15ULL;
+    return (hash ^ (hash >> 32)) & (table -> capacity - 1);
+}
+
+void site_table_set(struct arena_t * arena, struct chunk_t * chunk, int line, const char * filename)
+{
+    if (!siteTableEnabled) return;
+
+    struct site_table_t * table = &arena -> sites;
+    if ((table -> count + 1) * 2 > table -> capacity)
+    {
+        //Table doubles and every entry is placed again
+        size_t capacity = table -> capacity ? table -> capacity * 2 : SITE_TABLE_MIN_CAPACITY;
+        struct site_t * slots = mmap(NULL, capacity * sizeof(struct site_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slots == MAP_FAILED)
+        {
+            heap_message("Site table couldn't get memory\n");
+            return;
+        }
+
+        struct site_table_t grown = {slots, capacity, 0};
+        for (size_t i = 0; i < table -> capacity; i++)
+        {
+            if (table -> slots[i].chunk == NULL) continue;
+            size_t slot = site_slot(&grown, table -> slots[i].chunk);
+            while (slots[slot].chunk) slot = (slot + 1) & (capacity - 1);
+            slots[slot] = table -> slots[i];
+            grown.count++;
+        }
+        if (table -> slots) munmap(table -> slots, table -> capacity * sizeof(struct site_t));
+        *table = grown;
+    }
+
+    size_t slot = site_slot(table, chunk);
+    while (table -> slots[slot].chunk && table -> slots[slot].chunk != chunk) slot = (slot + 1) & (table -> capacity - 1);
+    if (table -> slots[slot].chunk == NULL) table -> count++;
+
+    table -> slots[slot].chunk = chunk;
+    table -> slots[slot].line = line;
+    table -> slots[slot].filename = filename;
+}
+
+struct site_t * site_table_find(struct arena_t * arena, const struct chunk_t * chunk)
+{
+    struct site_table_t * table = &arena -> sites;
+    if (table -> count == 0) return NULL;
+
+    size_t slot = site_slot(table, chunk);
+    while (table -> slots[slot].chunk)
+    {
+        if (table -> slots[slot].chunk == chunk) return &table -> slots[slot];
+        slot = (slot + 1) & (table -> capacity - 1);
+    }
+    return NULL;
+}
+
+void site_table_remove(struct arena_t * arena, struct chunk_t * chunk)
+{
+    struct site_table_t * table = &arena -> sites;
+    struct site_t * site = site_table_find(arena, chunk);
+    if (site == NULL) return;
+
+    //Entries after the hole move back if their home slot allows it, so lookups never stop early
+    size_t mask = table -> capacity - 1;
+    size_t hole = site - table -> slots;
+    for (size_t slot = (hole + 1) & mask; table -> slots[slot].chunk; slot = (slot + 1) & mask)
+    {
+        size_t home = site_slot(table, table -> slots[slot].chunk);
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
+        {
+            table -> slots[hole] = table -> slots[slot];
+            hole = slot;
+        }
+    }
+    table -> slots[hole].chunk = NULL;
+    table -> count--;
+}
+
+void site_table_clear(struct arena_t * arena)
+{
+    struct site_table_t * table = &arena -> sites;
+    if (table -> slots) memset(table -> slots, 0, table -> capacity * sizeof(struct site_t));
+    table -> count = 0;
+}
+
+int site_line(struct arena_t * arena, const struct chunk_t * chunk)
+{
+    struct site_t * site = site_table_find(arena, chunk);
+    return site ? site -> line : 0;
+}
+
+const char * site_filename(struct arena_t * arena, const struct chunk_t * chunk)
+{
+    struct site_t * site = site_table_find(arena, chunk);
+    return site ? site -> filename : "unknown";
+}
+
+void heap_set_site_table(int enabled)
+{
+    //Blocks allocated while the table is off show up without a line and filename
+    siteTableEnabled = enabled;
+}
+
+size_t profile_slot(const struct profile_table_t * table, int line, const char * filename)
+{
+    uint64_t hash = ((uintptr_t)filename ^ ((uint64_t)line << 32)) * 0x9E3779B97F4A7C15ULL;
+    return (hash ^ (hash >> 32)) & (table -> capacity - 1);
+}
+
+struct heap_site_stats_t * profile_find(int line, const char * filename, int create)
+{
+    //Sites are told apart by the filename pointer, every file passes the same __FILE__ literal
+    //The caller holds profileMutex
+    struct profile_table_t * table = &siteProfile;
+    if (create && (table -> count + 1) * 2 > table -> capacity)
+    {
+        //Table doubles and every site is placed again
+        size_t capacity = table -> capacity ? table -> capacity * 2 : PROFILE_MIN_CAPACITY;
+        struct heap_site_stats_t * slots = mmap(NULL, capacity * sizeof(struct heap_site_stats_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slots == MAP_FAILED) return NULL;
+
+        struct profile_table_t grown = {slots, capacity, table -> count};
+        for (size_t i = 0; i < table -> capacity; i++)
+        {
+            if (table -> slots[i].filename == NULL) continue;
+            size_t slot = profile_slot(&grown, table -> slots[i].line, table -> slots[i].filename);
+            while (slots[slot].filename) slot = (slot + 1) & (capacity - 1);
+            slots[slot] = table -> slots[i];
+        }
+        if (table -> slots) munmap(table -> slots, table -> capacity * sizeof(struct heap_site_stats_t));
+        *table = grown;
+    }
+    if (table -> capacity == 0) return NULL;
+
+    size_t slot = profile_slot(table, line, filename);
+    while (table -> slots[slot].filename)
+    {
+        if (table -> slots[slot].filename == filename && table -> slots[slot].line == line) return &table -> slots[slot];
+        slot = (slot + 1) & (table -> capacity - 1);
+    }
+    if (!create) return NULL;
+
+    table -> slots[slot].filename = filename;
+    table -> slots[slot].line = line;
+    table -> count++;
+    return &table -> slots[slot];
+}
+
+void profile_update(int line, const char * filename, int64_t bytes, int count)
+{
+    //count is 1 for a new block, -1 for a freed one and 0 for a block which changed its size
+    if (!profileEnabled || profileParking) return;
+    if (filename == NULL) filename = "unknown";
+
+    pthread_mutex_lock(&profileMutex);
+    struct heap_site_stats_t * site = profile_find(line, filename, count > 0);
+
+    //Blocks allocated before profiling was turned on aren't in the profile
+    if (site && (count > 0 || site -> live_count > 0))
+    {
+        if (bytes < 0 && (uint64_t)-bytes > site -> live_bytes) site -> live_bytes = 0;
+        else site -> live_bytes += bytes;
+        site -> live_count += count;
+        if (count > 0)
+        {
+            site -> total_count++;
+            site -> total_bytes += bytes;
+        }
+        if (site -> live_bytes > site -> peak_bytes) site -> peak_bytes = site -> live_bytes;
+    }
+    pthread_mutex_unlock(&profileMutex);
+}
+
+void profile_chunk(struct arena_t * arena, struct chunk_t * chunk, int64_t bytes, int count)
+{
+    //Site of a block comes from its header or the site table, so it has to be read before the site is cleared
+    if (!profileEnabled) return;
+    profile_update(chunk_line(arena, chunk), chunk_filename(arena, chunk), bytes, count);
+}
+
+void profile_clear(void)
+{
+    pthread_mutex_lock(&profileMutex);
+    if (siteProfile.slots) memset(siteProfile.slots, 0, siteProfile.capacity * sizeof(struct heap_site_stats_t));
+    siteProfile.count = 0;
+    pthread_mutex_unlock(&profileMutex);
+}
+
+int profile_compare(const void * a, const void * b)
+{
+    //Most live bytes first, sites which allocated more come first among equals
+    const struct heap_site_stats_t * x = a, * y = b;
+    if (x -> live_bytes != y -> live_bytes) return x -> live_bytes < y -> live_bytes ? 1 : -1;
+    if (x -> total_bytes != y -> total_bytes) return x -> total_bytes < y -> total_bytes ? 1 : -1;
+    return 0;
+}
+
+struct heap_site_stats_t * profile_sorted(size_t * count)
+{
+    //Copy of the sites taken under the lock, the caller unmaps it with profile_free_sorted
+    struct heap_site_stats_t * sites = NULL;
+    *count = 0;
+
+    pthread_mutex_lock(&profileMutex);
+    if (siteProfile.count)
+    {
+        sites = mmap(NULL, siteProfile.count * sizeof(struct heap_site_stats_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (sites == MAP_FAILED) sites = NULL;
+        for (size_t i = 0; sites && i < siteProfile.capacity; i++)
+        {
+            if (siteProfile.slots[i].filename) sites[(*count)++] = siteProfile.slots[i];
+        }
+    }
+    pthread_mutex_unlock(&profileMutex);
+
+    if (sites) qsort(sites, *count, sizeof(struct heap_site_stats_t), profile_compare);
+    return sites;
+}
+
+void profile_free_sorted(struct heap_site_stats_t * sites, size_t count)
+{
+    if (sites) munmap(sites, count * sizeof(struct heap_site_stats_t));
+}
+
+void heap_set_site_profile(int enabled)
+{
+    //Blocks allocated while the profile is off are left out of it, even when they are freed later
+    profileEnabled = enabled;
+}
+
+int heap_get_site_profile(struct heap_site_stats_t * sites, int capacity)
+{
+    //Fills sites with the sites holding the most live bytes and returns how many were written
+    if (sites == NULL || capacity < 0) return -1;
+
+    size_t count;
+    struct heap_site_stats_t * sorted = profile_sorted(&count);
+    int written = count < (size_t)capacity ? (int)count : capacity;
+    if (written) memcpy(sites, sorted, written * sizeof(struct heap_site_stats_t));
+    profile_free_sorted(sorted, count);
+    return written;
+}
+
+int heap_dump_site_profile(FILE * out, enum profile_format_t format)
+{
+    if (out == NULL) return -1;
+
+    size_t count;
+    struct heap_site_stats_t * sites = profile_sorted(&count);
+    if (sites == NULL && count) return -1;
+
+    if (format == profile_pprof)
+    {
+        //Legacy heap profile with a symbol section, every site stands for a frame of its own
+        uint64_t live_count = 0, live_bytes = 0, total_count = 0, total_bytes = 0;
+        fprintf(out, "--- symbol\nbinary=heap\n");
+        for (size_t i = 0; i < count; i++)
+        {
+            fprintf(out, "0x%016zx %s:%d\n", i + 1, sites[i].filename, sites[i].line);
+            live_count += sites[i].live_count;
+            live_bytes += sites[i].live_bytes;
+            total_count += sites[i].total_count;
+            total_bytes += sites[i].total_bytes;
+        }
+        fprintf(out, "---\n--- profile\n");
+        fprintf(out, "heap profile: %lu: %lu [%lu: %lu] @ heapprofile\n", (unsigned long)live_count, (unsigned long)live_bytes,
+            (unsigned long)total_count, (unsigned long)total_bytes);
+        for (size_t i = 0; i < count; i++)
+        {
+            fprintf(out, "%lu: %lu [%lu: %lu] @ 0x%016zx\n", (unsigned long)sites[i].live_count, (unsigned long)sites[i].live_bytes,
+                (unsigned long)sites[i].total_count, (unsigned long)sites[i].total_bytes, i + 1);
+        }
+    }
+    else
+    {
+        fprintf(out, "%14s %12s %14s %14s %12s  %s\n", "live bytes", "live blocks", "peak bytes", "total bytes", "allocations", "site");
+        for (size_t i = 0; i < count; i++)
+        {
+            fprintf(out, "%14lu %12lu %14lu %14lu %12lu  %s:%d\n", (unsigned long)sites[i].live_bytes, (unsigned long)sites[i].live_count,
+                (unsigned long)sites[i].peak_bytes, (unsigned long)sites[i].total_bytes, (unsigned long)sites[i].total_count,
+                sites[i].filename, sites[i].line);
+        }
+    }
+
+    profile_free_sorted(sites, count);
+    return 0;
+}
+
+size_t sample_slot(size_t capacity, const void * ptr)
+{
+    uint64_t hash = ((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+    return (hash ^ (hash >> 32)) & (capacity - 1);
+}
+
+uint64_t sample_random(void)
+{
+    //xorshift64* of the thread, seeded from its own address and the clock
+    if (sampleSeed == 0) sampleSeed = ((uintptr_t)&sampleSeed ^ latency_now()) | 1;
+    sampleSeed ^= sampleSeed >> 12;
+    sampleSeed ^= sampleSeed << 25;
+    sampleSeed ^= sampleSeed >> 27;
+    return sampleSeed * 0x2545F4914F6CDD1DULL;
+}
+
+double sample_log2(uint64_t x)
+{
+    //Exponent from the leading bit and a quadratic for the mantissa, close enough for sampling and no libm
+    int exponent = 63 - __builtin_clzll(x);
+    double t = (double)x / ((uint64_t)1 << exponent) - 1;
+    return exponent + t * (1.3465 - 0.3465 * t);
+}
+
+int64_t sample_next_interval(void)
+{
+    //Gaps between samples follow an exponential distribution, so every byte has the same chance to be sampled
+    uint64_t u = (sample_random() >> 11) + 1; //Uniform in 1 .. 2^53
+    double gap = (53 - sample_log2(u)) * 0.6931471805599453 * sampleInterval;
+    return (int64_t)gap + 1;
+}
+
+uint64_t sample_weight(size_t size)
+{
+    //Bytes a sample stands for, size divided by the chance 1 - e^(-size / interval) of sampling it
+    double x = (double)size / sampleInterval;
+    if (x > 40) return size;
+
+    //e^-x from a short series on x / 2^k squared k times
+    int k = 0;
+    while (x / ((uint64_t)1 << k) > 0.25) k++;
+    double y = x / ((uint64_t)1 << k);
+    double e = 1 - y + y * y / 2 - y * y * y / 6 + y * y * y * y / 24;
+    for (int i = 0; i < k; i++) e *= e;
+
+    return (uint64_t)(size / (1 - e));
+}
+
+struct heap_sample_t * sample_find(const void * ptr)
+{
+    //The caller holds samplesMutex
+    if (samples.count == 0) return NULL;
+
+    size_t slot = sample_slot(samples.capacity, ptr);
+    while (samples.slots[slot].ptr)
+    {
+        if (samples.slots[slot].ptr == ptr) return &samples.slots[slot];
+        slot = (slot + 1) & (samples.capacity - 1);
+    }
+    return NULL;
+}
+
+int sample_insert(const struct heap_sample_t * sample)
+{
+    //The caller holds samplesMutex, returns -1 when the table couldn't grow
+    if ((samples.count + 1) * 2 > samples.capacity)
+    {
+        size_t capacity = samples.capacity ? samples.capacity * 2 : SAMPLE_MIN_CAPACITY;
+        struct heap_sample_t * slots = mmap(NULL, capacity * sizeof(struct heap_sample_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slots == MAP_FAILED) return -1;
+
+        for (size_t i = 0; i < samples.capacity; i++)
+        {
+            if (samples.slots[i].ptr == NULL) continue;
+            size_t slot = sample_slot(capacity, samples.slots[i].ptr);
+            while (slots[slot].ptr) slot = (slot + 1) & (capacity - 1);
+            slots[slot] = samples.slots[i];
+        }
+        if (samples.slots) munmap(samples.slots, samples.capacity * sizeof(struct heap_sample_t));
+        samples.slots = slots;
+        samples.capacity = capacity;
+    }
+
+    size_t slot = sample_slot(samples.capacity, sample -> ptr);
+    while (samples.slots[slot].ptr) slot = (slot + 1) & (samples.capacity - 1);
+    samples.slots[slot] = *sample;
+    samples.count++;
+    //A full counter sticks, the slot then always takes the lock instead of wrapping back to zero
+    uint8_t * filter = &sampleFilter[sample_slot(SAMPLE_FILTER_SIZE, sample -> ptr)];
+    if (*filter < UINT8_MAX) __atomic_store_n(filter, *filter + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void sample_remove(struct heap_sample_t * sample)
+{
+    //Same backward shift as the site table, the caller holds samplesMutex
+    uint8_t * filter = &sampleFilter[sample_slot(SAMPLE_FILTER_SIZE, sample -> ptr)];
+    if (*filter < UINT8_MAX) __atomic_store_n(filter, *filter - 1, __ATOMIC_RELAXED);
+
+    size_t mask = samples.capacity - 1;
+    size_t hole = sample - samples.slots;
+    for (size_t slot = (hole + 1) & mask; samples.slots[slot].ptr; slot = (slot + 1) & mask)
+    {
+        size_t home = sample_slot(samples.capacity, samples.slots[slot].ptr);
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
+        {
+            samples.slots[hole] = samples.slots[slot];
+            hole = slot;
+        }
+    }
+    samples.slots[hole].ptr = NULL;
+    samples.count--;
+}
+
+void sample_allocation(void * ptr, size_t bytes, int line, const char * filename)
+{
+    //Called by the public allocation functions once the block is handed out and no lock is held
+    if (sampleInterval == 0 || ptr == NULL || sampleBusy) return;
+
+    if (sampleCountdown == 0) sampleCountdown = sample_next_interval();
+    sampleCountdown -= bytes;
+    if (sampleCountdown > 0) return;
+    sampleCountdown = sample_next_interval();
+
+    sampleBusy = 1;
+    struct heap_sample_t sample = {ptr, bytes, sample_weight(bytes), line, filename, 0};
+    void * frames[SAMPLE_MAX_FRAMES + 1];
+    int depth = backtrace(frames, SAMPLE_MAX_FRAMES + 1);
+
+    //First frame is sample_allocation itself
+    for (int i = 1; i < depth; i++) sample.frames[sample.depth++] = frames[i];
+
+    pthread_mutex_lock(&samplesMutex);
+    struct heap_sample_t * stale = sample_find(ptr);
+    if (stale) sample_remove(stale);
+    sample_insert(&sample);
+    pthread_mutex_unlock(&samplesMutex);
+    sampleBusy = 0;
+}
+
+int sample_filtered(const void * ptr)
+{
+    //No lock and no shared write for blocks which were never sampled
+    if (__atomic_load_n(&samples.count, __ATOMIC_RELAXED) == 0) return 1;
+    return __atomic_load_n(&sampleFilter[sample_slot(SAMPLE_FILTER_SIZE, ptr)], __ATOMIC_RELAXED) == 0;
+}
+
+void sample_forget(const void * ptr)
+{
+    //Called on free, the sample goes away with its block
+    if (ptr == NULL || sample_filtered(ptr)) return;
+
+    pthread_mutex_lock(&samplesMutex);
+    struct heap_sample_t * sample = sample_find(ptr);
+    if (sample) sample_remove(sample);
+    pthread_mutex_unlock(&samplesMutex);
+}
+
+void sample_move(const void * ptr, void * moved)
+{
+    //Mapped blocks resized in place may get a new address, their sample follows them
+    if (ptr == moved || ptr == NULL || sample_filtered(ptr)) return;
+
+    pthread_mutex_lock(&samplesMutex);
+    struct heap_sample_t * sample = sample_find(ptr);
+    if (sample)
+    {
+        struct heap_sample_t copy = *sample;
+        sample_remove(sample);
+        copy.ptr = moved;
+        sample_insert(&copy);
+    }
+    pthread_mutex_unlock(&samplesMutex);
+}
+
+void sample_clear(void)
+{
+    pthread_mutex_lock(&samplesMutex);
+    if (samples.slots) memset(samples.slots, 0, samples.capacity * sizeof(struct heap_sample_t));
+    memset(sampleFilter, 0, sizeof(sampleFilter));
+    samples.count = 0;
+    pthread_mutex_unlock(&samplesMutex);
+}
+
+void heap_set_sample_interval(size_t bytes)
+{
+    //Threads draw their next gap with the new mean once their current one runs out
+    sampleInterval = bytes;
+}
+
+int heap_get_samples(struct heap_sample_t * out, int capacity)
+{
+    //Copies up to capacity samples and returns how many were copied
+    if (out == NULL || capacity < 0) return -1;
+
+    int written = 0;
+    pthread_mutex_lock(&samplesMutex);
+    for (size_t i = 0; i < samples.capacity && written < capacity; i++)
+    {
+        if (samples.slots[i].ptr) out[written++] = samples.slots[i];
+    }
+    pthread_mutex_unlock(&samplesMutex);
+    return written;
+}
+
+int heap_dump_samples(const char * path)
+{
+    //Legacy pprof heap profile, pprof scales the samples back up with the interval in the header
+    //Samples are copied first so the file is written without holding the lock
+    pthread_mutex_lock(&samplesMutex);
+    size_t count = samples.count;
+    struct heap_sample_t * copy = NULL;
+    if (count)
+    {
+        copy = mmap(NULL, count * sizeof(struct heap_sample_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (copy == MAP_FAILED)
+        {
+            pthread_mutex_unlock(&samplesMutex);
+            return -1;
+        }
+        size_t copied = 0;
+        for (size_t i = 0; i < samples.capacity; i++)
+        {
+            if (samples.slots[i].ptr) copy[copied++] = samples.slots[i];
+        }
+    }
+    pthread_mutex_unlock(&samplesMutex);
+
+    FILE * out = fopen(path, "w");
+    if (out == NULL)
+    {
+        if (copy) munmap(copy, count * sizeof(struct heap_sample_t));
+        return -1;
+    }
+
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; i++) bytes += copy[i].size;
+    fprintf(out, "heap profile: %zu: %lu [%zu: %lu] @ heap_v2/%zu\n", count, (unsigned long)bytes, count, (unsigned long)bytes, sampleInterval);
+    for (size_t i = 0; i < count; i++)
+    {
+        fprintf(out, "1: %zu [1: %zu] @", copy[i].size, copy[i].size);
+        for (int f = 0; f < copy[i].depth; f++) fprintf(out, " %p", copy[i].frames[f]);
+        fprintf(out, "\n");
+    }
+
+    //Addresses are resolved by pprof with the mappings of the process
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    FILE * maps = fopen("/proc/self/maps", "r");
+    if (maps)
+    {
+        char buffer[4096];
+        size_t read;
+        while ((read = fread(buffer, 1, sizeof(buffer), maps)) > 0) fwrite(buffer, 1, read, out);
+        fclose(maps);
+    }
+
+    if (copy) munmap(copy, count * sizeof(struct heap_sample_t));
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+void * node_pool_grow(void * nodes, uint32_t * capacity, uint32_t top, size_t node_size)
+{
+    //Nodes are addressed by index so they can be copied to the doubled array as they are
+    //Returns NULL and leaves the pool as it was when there is no memory
+    uint32_t grown = *capacity ? *capacity * 2 : SIZE_INDEX_MIN_CAPACITY;
+    void * res = mmap(NULL, grown * node_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED) return NULL;
+
+    if (nodes)
+    {
+        memcpy(res, nodes, (top + 1) * node_size);
+        munmap(nodes, *capacity * node_size);
+    }
+    *capacity = grown;
+    return res;
+}
+
+uint32_t size_node_new(struct size_index_t * index, uint32_t size)
+{
+    //Returns 0 when the index couldn't get memory for the node
+    uint32_t node = index -> free_list;
+    if (node) index -> free_list = index -> nodes[node].right;
+    else
+    {
+        if (index -> top + 1 >= index -> capacity)
+        {
+            struct size_node_t * nodes = node_pool_grow(index -> nodes, &index -> capacity, index -> top, sizeof(struct size_node_t));
+            if (nodes == NULL)
+            {
+                heap_message("Size index couldn't get memory\n");
+                return 0;
+            }
+            index -> nodes = nodes;
+        }
+        node = ++index -> top;
+    }
+
+    index -> seed = index -> seed * 1103515245 + 12345;
+    index -> nodes[node] = (struct size_node_t){size, 1, index -> seed, 0, 0};
+    return node;
+}
+
+uint32_t size_node_insert(struct size_index_t * index, uint32_t node, uint32_t size)
+{
+    //Returns the root of the subtree after the insertion, nodes with higher priority stay on top
+    if (node == 0) return size_node_new(index, size);
+
+    struct size_node_t * nodes = index -> nodes;
+    if (size == nodes[node].size)
+    {
+        nodes[node].count++;
+        return node;
+    }
+
+    if (size < nodes[node].size)
+    {
+        uint32_t child = size_node_insert(index, nodes[node].left, size);
+        nodes = index -> nodes;
+        nodes[node].left = child;
+        if (child && nodes[child].priority > nodes[node].priority)
+        {
+            nodes[node].left = nodes[child].right;
+            nodes[child].right = node;
+            return child;
+        }
+    }
+    else
+    {
+        uint32_t child = size_node_insert(index, nodes[node].right, size);
+        nodes = index -> nodes;
+        nodes[node].right = child;
+        if (child && nodes[child].priority > nodes[node].priority)
+        {
+            nodes[node].right = nodes[child].left;
+            nodes[child].left = node;
+            return child;
+        }
+    }
+    return node;
+}
+
+uint32_t size_node_merge(struct size_index_t * index, uint32_t left, uint32_t right)
+{
+    //Joins two subtrees where every size of left is smaller than every size of right
+    if (left == 0) return right;
+    if (right == 0) return left;
+
+    struct size_node_t * nodes = index -> nodes;
+    if (nodes[left].priority > nodes[right].priority)
+    {
+        nodes[left].right = size_node_merge(index, nodes[left].right, right);
+        return left;
+    }
+    nodes[right].left = size_node_merge(index, left, nodes[right].left);
+    return right;
+}
+
+uint32_t size_node_remove(struct size_index_t * index, uint32_t node, uint32_t size)
+{
+    //Returns the root of the subtree after the removal, the node goes away with its last block
+    if (node == 0) return 0;
+
+    struct size_node_t * nodes = index -> nodes;
+    if (size < nodes[node].size) nodes[node].left = size_node_remove(index, nodes[node].left, size);
+    else if (size > nodes[node].size) nodes[node].right = size_node_remove(index, nodes[node].right, size);
+    else if (--nodes[node].count == 0)
+    {
+        uint32_t merged = size_node_merge(index, nodes[node].left, nodes[node].right);
+        nodes[node].right = index -> free_list;
+        index -> free_list = node;
+        return merged;
+    }
+    return node;
+}
+
+void size_index_add(struct size_index_t * index, size_t size)
+{
+    index -> count++;
+    index -> bytes += size;
+    index -> root = size_node_insert(index, index -> root, size);
+}
+
+void size_index_remove(struct size_index_t * index, size_t size)
+{
+    index -> count--;
+    index -> bytes -= size;
+    index -> root = size_node_remove(index, index -> root, size);
+}
+
+size_t size_index_max(const struct size_index_t * index)
+{
+    //Largest size is at the end of the right spine
+    uint32_t node = index -> root;
+    if (node == 0) return 0;
+    while (index -> nodes[node].right) node = index -> nodes[node].right;
+    return index -> nodes[node].size;
+}
+
+void size_index_clear(struct size_index_t * index)
+{
+    //Memory of the nodes is kept for the next use
+    index -> top = 0;
+    index -> free_list = 0;
+    index -> root = 0;
+    index -> count = 0;
+    index -> bytes = 0;
+}
+
+int free_node_before(const struct free_tree_t * tree, uint32_t size, const struct chunk_t * chunk, uint32_t node)
+{
+    //Address order, or size order with ties broken by address
+    const struct free_node_t * other = &tree -> nodes[node];
+    if (tree -> by_size && size != other -> size) return size < other -> size;
+    return (const char *)chunk < (const char *)other -> chunk;
+}
+
+void free_node_update(struct free_tree_t * tree, uint32_t node)
+{
+    //Largest block of the subtree lets address ordered searches skip subtrees where nothing fits
+    struct free_node_t * nodes = tree -> nodes;
+    uint32_t max_size = nodes[node].size;
+    if (nodes[node].left && nodes[nodes[node].left].max_size > max_size) max_size = nodes[nodes[node].left].max_size;
+    if (nodes[node].right && nodes[nodes[node].right].max_size > max_size) max_size = nodes[nodes[node].right].max_size;
+    nodes[node].max_size = max_size;
+}
+
+uint32_t free_node_insert(struct free_tree_t * tree, uint32_t node, uint32_t created)
+{
+    //Returns the root of the subtree after the insertion, nodes with higher priority stay on top
+    if (node == 0) return created;
+
+    struct free_node_t * nodes = tree -> nodes;
+    uint32_t top = node;
+    if (free_node_before(tree, nodes[created].size, nodes[created].chunk, node))
+    {
+        uint32_t child = nodes[node].left = free_node_insert(tree, nodes[node].left, created);
+        if (nodes[child].priority > nodes[node].priority)
+        {
+            nodes[node].left = nodes[child].right;
+            nodes[child].right = node;
+            top = child;
+        }
+    }
+    else
+    {
+        uint32_t child = nodes[node].right = free_node_insert(tree, nodes[node].right, created);
+        if (nodes[child].priority > nodes[node].priority)
+        {
+            nodes[node].right = nodes[child].left;
+            nodes[child].left = node;
+            top = child;
+        }
+    }
+
+    free_node_update(tree, node);
+    if (top != node) free_node_update(tree, top);
+    return top;
+}
+
+uint32_t free_node_merge(struct free_tree_t * tree, uint32_t left, uint32_t right)
+{
+    //Joins two subtrees where every key of left comes before every key of right
+    if (left == 0) return right;
+    if (right == 0) return left;
+
+    struct free_node_t * nodes = tree -> nodes;
+    if (nodes[left].priority > nodes[right].priority)
+    {
+        nodes[left].right = free_node_merge(tree, nodes[left].right, right);
+        free_node_update(tree, left);
+        return left;
+    }
+    nodes[right].left = free_node_merge(tree, left, nodes[right].left);
+    free_node_update(tree, right);
+    return right;
+}
+
+uint32_t free_node_remove(struct free_tree_t * tree, uint32_t node, uint32_t size, const struct chunk_t * chunk)
+{
+    //Returns the root of the subtree after the removal
+    if (node == 0) return 0;
+
+    struct free_node_t * nodes = tree -> nodes;
+    if (nodes[node].chunk == chunk)
+    {
+        uint32_t merged = free_node_merge(tree, nodes[node].left, nodes[node].right);
+        nodes[node].right = tree -> free_list;
+        tree -> free_list = node;
+        tree -> count--;
+        return merged;
+    }
+
+    if (free_node_before(tree, size, chunk, node)) nodes[node].left = free_node_remove(tree, nodes[node].left, size, chunk);
+    else nodes[node].right = free_node_remove(tree, nodes[node].right, size, chunk);
+    free_node_update(tree, node);
+    return node;
+}
+
+void free_tree_insert(struct free_tree_t * tree, struct chunk_t * chunk)
+{
+    uint32_t node = tree -> free_list;
+    if (node) tree -> free_list = tree -> nodes[node].right;
+    else
+    {
+        if (tree -> top + 1 >= tree -> capacity)
+        {
+            struct free_node_t * nodes = node_pool_grow(tree -> nodes, &tree -> capacity, tree -> top, sizeof(struct free_node_t));
+            if (nodes == NULL)
+            {
+                //The block stays in its bin, only this placement policy won't see it
+                heap_message("Free tree couldn't get memory\n");
+                return;
+            }
+            tree -> nodes = nodes;
+        }
+        node = ++tree -> top;
+    }
+
+    tree -> seed = tree -> seed * 1103515245 + 12345;
+    tree -> nodes[node] = (struct free_node_t){chunk, chunk -> size, chunk -> size, tree -> seed, 0, 0};
+    tree -> root = free_node_insert(tree, tree -> root, node);
+    tree -> count++;
+}
+
+void free_tree_remove(struct free_tree_t * tree, struct chunk_t * chunk)
+{
+    tree -> root = free_node_remove(tree, tree -> root, chunk -> size, chunk);
+}
+
+void free_tree_clear(struct free_tree_t * tree, int by_size)
+{
+    tree -> top = 0;
+    tree -> free_list = 0;
+    tree -> root = 0;
+    tree -> count = 0;
+    tree -> by_size = by_size;
+}
+
+uint32_t free_node_first(const struct free_tree_t * tree, uint32_t node, uint32_t needed_space, const char * from)
+{
+    //Lowest address block which fits starting at from or later, trees ordered by address only
+    //Blocks fit when they match perfectly or when they can be splitted, subtrees with only smaller blocks are skipped
+    const struct free_node_t * nodes = tree -> nodes;
+    if (node == 0 || nodes[node].max_size < needed_space) return 0;
+
+    if ((const char *)nodes[node].chunk >= from)
+    {
+        uint32_t res = free_node_first(tree, nodes[node].left, needed_space, from);
+        if (res) return res;
+        if (nodes[node].size == needed_space || nodes[node].size >= needed_space + metadata_size) return node;
+    }
+    return free_node_first(tree, nodes[node].right, needed_space, from);
+}
+
+uint32_t free_node_smallest(const struct free_tree_t * tree, uint32_t size)
+{
+    //Smallest block of at least size bytes, the lowest address among equal sizes, trees ordered by size
+    uint32_t node = tree -> root, res = 0;
+    while (node)
+    {
+        if (tree -> nodes[node].size >= size)
+        {
+            res = node;
+            node = tree -> nodes[node].left;
+        }
+        else node = tree -> nodes[node].right;
+    }
+    return res;
+}
+
+struct chunk_t * free_tree_find(struct arena_t * arena, uint32_t needed_space)
+{
+    struct free_tree_t * tree = &arena -> free_tree;
+    uint32_t node;
+    if (arena -> placement == placement_best_fit)
+    {
+        //A block a bit larger than needed can't be splitted, the next size up is then the smallest fit
+        node = free_node_smallest(tree, needed_space);
+        if (node && tree -> nodes[node].size != needed_space && tree -> nodes[node].size < needed_space + metadata_size) node = free_node_smallest(tree, needed_space + metadata_size);
+    }
+    else if (arena -> placement == placement_next_fit)
+    {
+        //Search goes on from the last placed block and wraps around to the start of the arena
+        node = free_node_first(tree, tree -> root, needed_space, arena -> rover);
+        if (node == 0) node = free_node_first(tree, tree -> root, needed_space, NULL);
+    }
+    else node = free_node_first(tree, tree -> root, needed_space, NULL);
+
+    return node ? tree -> nodes[node].chunk : NULL;
+}
+
+void heap_set_placement_policy(enum placement_policy_t policy)
+{
+    //Arenas take the policy when they are set up, so it applies from the next heap_setup or heap_reset
+    placementPolicy = policy;
+}
+
+enum placement_policy_t heap_get_placement_policy(void)
+{
+    return placementPolicy;
+}
+
+struct chunk_t * find_suitable_block(struct arena_t * arena, uint32_t needed_space)
+{
+    //Look for a freed block starting from the bin of the requested size
+    //A block fits if it matches perfectly or if it can be splitted
+    uint64_t start = latency_start();
+    struct chunk_t * temp = NULL;
+    uint64_t candidates = arena -> free_bins_map & (~(uint64_t)0 << bin_index(needed_space));
+    if (arena -> placement != placement_good_fit)
+    {
+        temp = free_tree_find(arena, needed_space);
+        candidates = 0;
+    }
+    while (candidates && temp == NULL)
+    {
+        size_t index = __builtin_ctzl(candidates);
+        candidates &= candidates - 1;
+
+        for (temp = arena -> free_bins[index]; temp; temp = chunk_next_free(temp))
+        {
+            if (temp -> size == needed_space || temp -> size >= (needed_space + metadata_size)) break;
+        }
+    }
+    latency_record(latency_search, start);
+
+    if (temp == NULL) return NULL;
+    if (chunk_check(arena, temp) < 0)
+    {
+        heap_message("Detected heap integrity breach in a free block\n");
+        return NULL;
+    }
+
+    //This block can be used but should be splitted
+    if (temp -> size != needed_space) split(arena, temp, needed_space);
+    arena -> rover = (char *)temp;
+
+    //Caller takes the block so it leaves the free lists
+    bin_remove(arena, temp);
+    return temp;
+}
+
+struct chunk_t * heap_get_last_block(struct arena_t * arena)
+{
+    //Last block holds the last byte of the heap, the page map finds it without walking the heap
+    struct chunk_t * last_block = page_map_find(arena, (char *)arena -> heap.heap + arena -> heap.max_heap_size - 1);
+    return last_block ? last_block : arena -> heap.first_chunk;
+}
+
+size_t page_size(size_t number)
+{
+    size_t multiple = PAGE_SIZE;
+    return ((number + multiple - 1) / multiple) * multiple;
+}
+
+int coalesce_blocks(struct arena_t * arena, struct chunk_t * temp)
+{
+    if (!temp) return 0;
+    
+    struct chunk_t * right = chunk_next(temp);
+
+    if (arena_pointer_type(arena, right) == pointer_control_block)
+    {
+        if (right -> taken_flag == 0)
+        {
+            //Both blocks leave their bins, the merged one is binned again below
+            bin_remove(arena, right);
+            if (temp -> taken_flag == 0) bin_remove(arena, temp);
+            else
+            {
+                size_index_remove(&arena -> used_sizes, temp -> size);
+                profile_chunk(arena, temp, right -> size + metadata_size, 0);
+            }
+            page_map_remove(arena, right);
+
+            //Time to coalesce, the following chunk is linked once temp has its final size
+            struct chunk_t * after = chunk_next(right);
+            chunk_set_next(temp, after);
+            temp -> size += (right -> size + metadata_size);
+            temp -> checksum = 0;
+            temp -> checksum = add_bytes(temp, sizeof(struct chunk_t));
+            if (after)
+            {
+                chunk_set_prev(after, temp);
+                after -> checksum = 0;
+                after -> checksum = add_bytes(after, sizeof(struct chunk_t));
+            }
+            if (temp -> taken_flag == 0) bin_insert(arena, temp);
+            else size_index_add(&arena -> used_sizes, temp -> size);
+
+            arena -> heap.chunk_count--;
+            arena -> heap.checksum = 0;
+            arena -> heap.checksum = add_bytes(&arena -> heap, sizeof(heap));
+        }
+    }
+    else heap_message("Coalesce blocks didnt get pointer_control_block\n");
+    return 1;
+}
+
+void split(struct arena_t * arena, struct chunk_t * temp, size_t bytes)
+{
+    uint64_t start = latency_start();
+    struct chunk_t * right = chunk_next(temp);
+
+    //A free block changes its size so it has to change its bin as well
+    if (temp -> taken_flag == 0) bin_remove(arena, temp);
+    else
+    {
+        size_index_remove(&arena -> used_sizes, temp -> size);
+        size_index_add(&arena -> used_sizes, bytes);
+        profile_chunk(arena, temp, (int64_t)bytes - (int64_t)temp -> size, 0);
+    }
+
+    //calculate new size for the new block
+    int size_of_new_block = temp -> size - bytes - metadata_size;
+    //update size of the fitting block
+    temp -> size = bytes;
+    temp -> checksum = 0;
+    temp -> checksum = add_bytes(temp, sizeof(struct chunk_t));
+    //memcpy fence at the end of fitting block
+    char fence[fence_size];
+    for (int i = 0; i < fence_size; i++)
+    {
+        fence[i] = i;
+    }
+
+    memcpy(((char *)temp) + sizeof(struct chunk_t), fence, sizeof(fence));
+    memcpy(((char *)temp) + temp -> size + move_to_data_block, fence, sizeof(fence));
+    //create newblock with the remaining size
+    struct chunk_t newBlock;
+
+    memset(&newBlock, 0, sizeof(newBlock));
+    chunk_set_prev(&newBlock, temp);
+    chunk_set_next(&newBlock, right);
+    newBlock.size = size_of_new_block;
+    newBlock.taken_flag = 0;
+    newBlock.slab_flag = 0;
+    chunk_init_site(&newBlock);
+    newBlock.checksum = 0;
+    newBlock.checksum = add_bytes(&newBlock, sizeof(struct chunk_t));
+    
+    arena -> heap.chunk_count++;
+    arena -> heap.checksum = 0;
+    arena -> heap.checksum = add_bytes(&arena -> heap, sizeof(heap));
+
+    struct chunk_t * created = (struct chunk_t *)next_block(temp);
+    chunk_set_next(temp, created);
+    memcpy(created, &newBlock, sizeof(newBlock));
+    if (right) chunk_set_prev(right, created);
+
+    //set left fence of newblock as right doesnt need to be changed
+    memcpy(((char *)created + sizeof(struct chunk_t)), fence, sizeof(fence));
+
+    //update checksum of all blocks changed or created
+    temp -> checksum = 0;
+    temp -> checksum = add_bytes(temp, sizeof(struct chunk_t));
+
+    if (right)
+    {
+        right -> checksum = 0;
+        right -> checksum = add_bytes(right, sizeof(struct chunk_t));
+    }
+
+    //Remaining space is a new free block
+    page_map_add(arena, created);
+    bin_insert(arena, created);
+    if (temp -> taken_flag == 0) bin_insert(arena, temp);
+    latency_record(latency_split, start);
+}
+
+size_t get_payload_size(void * ptr)
+{
+    return heap_get_block_size(ptr);
+}
+
+void release_block(struct arena_t * arena, void * ptr)
+{
+    if (arena_check(arena) < 0)
+    {
+        heap_message("Detected heap integrity breach during heap_free\n");
+        return;
+    }
+
+    if (arena_pointer_type(arena, ptr) == pointer_valid)
+    {
+        //Objects of a slab have no header of their own
+        struct chunk_t * owner = page_map_find(arena, ptr);
+        if (owner -> slab_flag)
+        {
+            if (chunk_check(arena, owner) < 0)
+            {
+                heap_message("Detected heap integrity breach during heap_free\n");
+                return;
+            }
+            slab_free(arena, owner, ptr);
+            return;
+        }
+
+        struct chunk_t * temp = (struct chunk_t *)(((char *)ptr) - (move_to_data_block));
+        if (arena_pointer_type(arena, temp) != pointer_control_block)
+        {
+            heap_message("Invalid pointer passed to heap_free\n");
+        }
+        release_chunk(arena, temp);
+    }
+    else
+    {
+        heap_message("Invalid pointer passed to heap_free!\n");
+        heap_message("Passed pointer: %p\n", ptr);
+    }
+}
+
+void release_chunk(struct arena_t * arena, struct chunk_t * temp)
+{
+    //Freeing touches the block and both neighbours it may merge with
+    if (chunk_check(arena, temp) < 0 || chunk_check(arena, chunk_prev(temp)) < 0 || chunk_check(arena, chunk_next(temp)) < 0)
+    {
+        heap_message("Detected heap integrity breach during heap_free\n");
+        return;
+    }
+    profile_chunk(arena, temp, -(int64_t)temp -> size, -1);
+    chunk_clear_site(arena, temp);
+    size_index_remove(&arena -> used_sizes, temp -> size);
+    temp -> taken_flag = 0;
+    temp -> checksum = 0;
+    temp -> checksum = add_bytes(temp, sizeof(struct chunk_t));
+    bin_insert(arena, temp);
+
+    //Coalesce free blocks if such exist next to each other
+    if (chunk_prev(temp) && chunk_prev(temp) -> taken_flag == 0)
+    {
+        temp = chunk_prev(temp);
+        coalesce_blocks(arena, temp);
+    }
+
+    if (chunk_next(temp) && chunk_next(temp) -> taken_flag == 0) 
+    {
+        coalesce_blocks(arena, temp);
+    }
+
+    arena_shrink(arena, temp);
+}
+
+void arena_shrink(struct arena_t * arena, struct chunk_t * freed)
+{
+    //Free neighbours are always merged, so an empty arena is a single free block
+    struct chunk_t * first = arena -> heap.first_chunk;
+    if (first -> taken_flag == 0 && chunk_next(first) == NULL)
+    {
+        if (arena_reset(arena) < 0)
+        {
+            heap_message("Couldn't reset heap!\n");
+        }
+    }
+    else if (trimThreshold && chunk_next(freed) == NULL && freed -> size > trimThreshold)
+    {
+        //Half of the threshold stays so the next allocations don't grow the heap right away
+        arena_trim(arena, trimThreshold / 2);
+    }
+}
+
+void release_blocks(void ** pointers, int count)
+{
+    //Gives a batch of blocks back to their arenas, every arena is locked once per run of its blocks
+    struct arena_t * locked = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        struct arena_t * arena = arena_of(pointers[i]);
+        if (arena != locked)
+        {
+            if (locked) pthread_mutex_unlock(&locked -> lock);
+            locked = arena;
+            if (locked) arena_lock(locked);
+        }
+
+        if (arena) release_block(arena, pointers[i]);
+        else if (!mapping_release(pointers[i])) heap_message("Invalid pointer passed to heap_free!\nPassed pointer: %p\n", pointers[i]);
+    }
+    if (locked) pthread_mutex_unlock(&locked -> lock);
+}
+
+void heap_free_sized(void * ptr, size_t size)
+{
+    uint64_t start = latency_enter();
+    sample_forget(ptr);
+
+    //Sizes no thread cache class holds skip the checks of the cache, a size the cache rejects is reported by release_sized
+    if (size == 0 || size > TCACHE_MAX_SIZE || !thread_cache_put(ptr, size)) release_sized(ptr, size);
+    latency_leave(latency_free, start);
+}
+
+void release_sized(void * ptr, size_t size)
+{
+    //The size tells where the block lives: sizes at the mmap threshold try the mappings first,
+    //blocks in the heap go straight to their header instead of being found through the page map
+    if (mmapThreshold && size >= mmapThreshold && mapping_release(ptr)) return;
+
+    struct arena_t * arena = arena_of(ptr);
+    if (arena && remote_free_push(arena, ptr)) return;
+    if (arena == NULL)
+    {
+        release_blocks(&ptr, 1);
+        return;
+    }
+
+    arena_lock(arena);
+    struct chunk_t * temp = (struct chunk_t *)((char *)ptr - move_to_data_block);
+    struct chunk_t * owner = NULL;
+    char * end = (char *)arena -> heap.heap + arena -> heap.max_heap_size;
+    if (arena_check(arena) < 0) heap_message("Detected heap integrity breach during heap_free\n");
+    else if (slabEnabled && size <= SLAB_MAX_SIZE && arena_pointer_type(arena, ptr) == pointer_valid && (owner = page_map_find(arena, ptr)) -> slab_flag)
+    {
+        //Objects of a slab have no header, the size has to fall in the size class of their slab
+        if (size == 0 || ((size - 1) >> 4) != slab_of(owner) -> class)
+        {
+            heap_message("Size passed to heap_free_sized doesn't match the block\nPassed pointer: %p\nPassed size: %zu\n", ptr, size);
+        }
+        if (chunk_check(arena, owner) < 0) heap_message("Detected heap integrity breach during heap_free\n");
+        else slab_free(arena, owner, ptr);
+    }
+    else if ((char *)temp < (char *)arena -> heap.heap || (char *)ptr + size > end || temp -> taken_flag != 1 || temp -> slab_flag || size > temp -> size || temp -> size >= size + metadata_size)
+    {
+        //A block keeps up to a header more than asked for when the rest couldn't be split off, e.g. after a realloc
+        //Wrong sizes are reported, the block is then looked up like in heap_free
+        heap_message("Size passed to heap_free_sized doesn't match the block\nPassed pointer: %p\nPassed size: %zu\n", ptr, size);
+        release_block(arena, ptr);
+    }
+    else release_chunk(arena, temp);
+    pthread_mutex_unlock(&arena -> lock);
+}
+
+void heap_free_batch(void ** pointers, size_t count)
+{
+    //Pointers are sorted a window at a time, so every arena is locked once per window
+    //and blocks next to each other merge in a single sweep instead of one coalesce per free
+    void * window[FREE_BATCH_WINDOW];
+    for (size_t done = 0; done < count; done += FREE_BATCH_WINDOW)
+    {
+        size_t n = count - done < FREE_BATCH_WINDOW ? count - done : FREE_BATCH_WINDOW;
+        memcpy(window, pointers + done, n * sizeof(void *));
+        for (size_t i = 0; i < n; i++) sample_forget(window[i]);
+
+        qsort(window, n, sizeof(void *), compare_pointers);
+        release_sorted(window, n);
+    }
+}
+
+int compare_pointers(const void * a, const void * b)
+{
+    uintptr_t x = (uintptr_t)*(void * const *)a, y = (uintptr_t)*(void * const *)b;
+    return (x > y) - (x < y);
+}
+
+void release_sorted(void ** pointers, size_t count)
+{
+    //Arenas never overlap, so the sorted pointers of an arena form one run
+    size_t i = 0;
+    while (i < count)
+    {
+        struct arena_t * arena = arena_of(pointers[i]);
+        if (arena == NULL)
+        {
+            if (!mapping_release(pointers[i])) heap_message("Invalid pointer passed to heap_free!\nPassed pointer: %p\n", pointers[i]);
+            i++;
+            continue;
+        }
+
+        size_t run = i + 1;
+        while (run < count && arena_of(pointers[run]) == arena) run++;
+
+        arena_lock(arena);
+        arena_release_run(arena, pointers + i, run - i);
+        pthread_mutex_unlock(&arena -> lock);
+        i = run;
+    }
+}
+
+void arena_release_run(struct arena_t * arena, void ** pointers, size_t count)
+{
+    //Sorted pointers of one arena, the lock of the arena has to be held
+    if (arena_check(arena) < 0)
+    {
+        heap_message("Detected heap integrity breach during heap_free\n");
+        return;
+    }
+
+    //Objects of a slab go first, an empty slab merges with its neighbours before the blocks below stop being binned
+    struct chunk_t * chunks[FREE_BATCH_WINDOW];
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if ((i > 0 && pointers[i] == pointers[i - 1]) || arena_pointer_type(arena, pointers[i]) != pointer_valid)
+        {
+            heap_message("Invalid pointer passed to heap_free!\nPassed pointer: %p\n", pointers[i]);
+            continue;
+        }
+
+        struct chunk_t * owner = page_map_find(arena, pointers[i]);
+        if (owner -> slab_flag)
+        {
+            if (chunk_check(arena, owner) < 0)
+            {
+                heap_message("Detected heap integrity breach during heap_free\n");
+                return;
+            }
+            slab_free(arena, owner, pointers[i]);
+            continue;
+        }
+        chunks[n++] = owner;
+    }
+
+    //Every block and both neighbours it may merge with are checked before anything changes
+    for (size_t i = 0; i < n; i++)
+    {
+        if (chunk_check(arena, chunks[i]) < 0 || chunk_check(arena, chunk_prev(chunks[i])) < 0 || chunk_check(arena, chunk_next(chunks[i])) < 0)
+        {
+            heap_message("Detected heap integrity breach during heap_free\n");
+            return;
+        }
+    }
+
+    //Blocks are marked free without being binned, the sweep below bins every merged run once
+    for (size_t i = 0; i < n; i++)
+    {
+        profile_chunk(arena, chunks[i], -(int64_t)chunks[i] -> size, -1);
+        chunk_clear_site(arena, chunks[i]);
+        size_index_remove(&arena -> used_sizes, chunks[i] -> size);
+        chunks[i] -> taken_flag = 0;
+    }
+
+    struct chunk_t * merged = NULL;
+    size_t k = 0;
+    while (k < n)
+    {
+        //A free left neighbour is binned, freed blocks before it would have taken this block in already
+        struct chunk_t * start = chunks[k];
+        struct chunk_t * prev = chunk_prev(start);
+        if (prev && prev -> taken_flag == 0)
+        {
+            bin_remove(arena, prev);
+            start = prev;
+        }
+        else k++;
+
+        struct chunk_t * next = chunk_next(start);
+        while (next && next -> taken_flag == 0)
+        {
+            if (k < n && chunks[k] == next) k++;
+            else bin_remove(arena, next);
+
+            struct chunk_t * after = chunk_next(next);
+            page_map_remove(arena, next);
+            start -> size += next -> size + metadata_size;
+            arena -> heap.chunk_count--;
+            next = after;
+        }
+
+        chunk_set_next(start, next);
+        if (next)
+        {
+            chunk_set_prev(next, start);
+            next -> checksum = 0;
+            next -> checksum = add_bytes(next, sizeof(struct chunk_t));
+        }
+        start -> checksum = 0;
+        start -> checksum = add_bytes(start, sizeof(struct chunk_t));
+        bin_insert(arena, start);
+        merged = start;
+    }
+
+    arena -> heap.checksum = 0;
+    arena -> heap.checksum = add_bytes(&arena -> heap, sizeof(heap));
+    if (merged) arena_shrink(arena, merged);
+}
+
+int remote_free_push(struct arena_t * arena, void * ptr)
+{
+    //Blocks of another arena go to a free slot of its queue with a single CAS instead of waiting for its lock
+    //Returns 1 when the block was queued, 0 when it has to be released under the lock
+    //Neither the block nor the arena is read here, the pointer is checked when the queue is drained
+    if (!remoteFreeEnabled || arena == threadArena || ptr == NULL) return 0;
+
+    size_t first = ((uintptr_t)ptr >> 4) & (REMOTE_FREE_SLOTS - 1);
+    for (size_t probe = 0; probe < REMOTE_FREE_PROBES; probe++)
+    {
+        void * expected = NULL;
+        if (__atomic_compare_exchange_n(&arena -> remote_frees[(first + probe) & (REMOTE_FREE_SLOTS - 1)], &expected, ptr, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            __atomic_add_fetch(&arena -> remote_free_count, 1, __ATOMIC_RELEASE);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void remote_free_drain(struct arena_t * arena)
+{
+    //Takes every queued block and releases them as one sorted batch, the lock of the arena has to be held
+    //A block whose slot is filled after the count is cleared counts again, so the next drain finds it
+    if (__atomic_load_n(&arena -> remote_free_count, __ATOMIC_RELAXED) == 0) return;
+    __atomic_exchange_n(&arena -> remote_free_count, 0, __ATOMIC_ACQUIRE);
+
+    void * window[REMOTE_FREE_SLOTS];
+    size_t count = 0;
+    for (size_t i = 0; i < REMOTE_FREE_SLOTS; i++)
+    {
+        if (__atomic_load_n(&arena -> remote_frees[i], __ATOMIC_RELAXED) == NULL) continue;
+        void * ptr = __atomic_exchange_n(&arena -> remote_frees[i], NULL, __ATOMIC_ACQUIRE);
+        if (ptr) window[count++] = ptr;
+    }
+    if (count == 0) return;
+
+    //Queued blocks were freed by heap_free, so they leave the profile even when a thread cache moves blocks
+    int parking = profileParking;
+    profileParking = 0;
+    qsort(window, count, sizeof(void *), compare_pointers);
+    arena_release_run(arena, window, count);
+    profileParking = parking;
+}
+
+void heap_free(void * ptr)
+{
+    uint64_t start = latency_enter();
+    sample_forget(ptr);
+
+    //Small blocks go to the thread cache, which only marks their headers under the lock
+    //Blocks go back to the arena which owns them, not to the arena of the calling thread
+    //Cached blocks are given back under the lock, so a block queued for its arena is always live for the profile
+    if (!thread_cache_put(ptr, 0))
+    {
+        struct arena_t * arena = arena_of(ptr);
+        if (arena == NULL || !remote_free_push(arena, ptr)) release_blocks(&ptr, 1);
+    }
+    latency_leave(latency_free, start);
+}
+
+void thread_destroy(void * unused)
+{
+    //Thread is exiting, give every cached block back to the heap and leave the arena
+    thread_cache_flush();
+    latency_table_release();
+
+    if (threadArena)
+    {
+        pthread_mutex_lock(&arenasMutex);
+        threadArena -> threads--;
+        pthread_mutex_unlock(&arenasMutex);
+        threadArena = NULL;
+    }
+}
+
+void thread_create_key(void)
+{
+    pthread_key_create(&threadKey, thread_destroy);
+}
+
+void thread_register(void)
+{
+    if (threadRegistered) return;
+
+    //Registering the thread makes pthread call thread_destroy on thread exit
+    pthread_once(&threadOnce, thread_create_key);
+    pthread_setspecific(threadKey, &threadRegistered);
+    threadRegistered = 1;
+}
+
+void * thread_cache_get(size_t bytes)
+{
+    if (!threadCacheEnabled || bytes == 0 || bytes > TCACHE_MAX_SIZE) return NULL;
+
+    //Blocks cached before a heap reset no longer exist
+    if (threadCache.generation != heapGeneration)
+    {
+        memset(threadCache.counts, 0, sizeof(threadCache.counts));
+        threadCache.generation = heapGeneration;
+        return NULL;
+    }
+
+    //Blocks keep their exact payload size so only a block of the same size can be reused
+    int class = (bytes - 1) >> 3;
+    for (int i = threadCache.counts[class] - 1; i >= 0; i--)
+    {
+        if (threadCache.sizes[class][i] != bytes) continue;
+
+        void * ptr = threadCache.slots[class][i];
+        int line = threadCache.lines[class][i];
+        const char * filename = threadCache.filenames[class][i];
+        int last = --threadCache.counts[class];
+        threadCache.slots[class][i] = threadCache.slots[class][last];
+        threadCache.sizes[class][i] = threadCache.sizes[class][last];
+        threadCache.lines[class][i] = threadCache.lines[class][last];
+        threadCache.filenames[class][i] = threadCache.filenames[class][last];
+
+        //The mark is cleared under the lock, neighbours of the block rewrite its header under the same lock
+        struct arena_t * arena = arena_of(ptr);
+        arena_lock(arena);
+        thread_cache_mark(arena, (struct chunk_t *)((char *)ptr - move_to_data_block), 0);
+        pthread_mutex_unlock(&arena -> lock);
+
+        profile_update(line, filename, bytes, 1);
+        return ptr;
+    }
+
+    return NULL;
+}
+
+int thread_cache_put(void * ptr, size_t bytes)
+{
+    //bytes is the size passed to heap_free_sized, 0 when the caller doesn't know it
+    //Slab objects have no header to mark
+    if (!threadCacheEnabled || slabEnabled || ptr == NULL) return 0;
+
+    //The header is read and marked under the lock of the arena owning the block, which may not be the arena of the thread
+    struct arena_t * arena = arena_of(ptr);
+    if (arena == NULL) return 0;
+
+    //Only the block itself is checked, validating the whole arena on every free would cost more than the cache saves
+    arena_lock(arena);
+    struct chunk_t * chunk = (struct chunk_t *)((char *)ptr - move_to_data_block);
+    enum pointer_type_t type = arena_pointer_type(arena, ptr);
+
+    //A block already waiting in a cache of any thread was freed twice
+    if (type == pointer_unallocated && chunk -> taken_flag == CHUNK_CACHED)
+    {
+        pthread_mutex_unlock(&arena -> lock);
+        heap_message("Invalid pointer passed to heap_free!\n");
+        heap_message("Passed pointer: %p is already freed\n", ptr);
+        return 1;
+    }
+
+    //Anything else the cache can't hold takes the locked path, which reports invalid pointers as before
+    if (type != pointer_valid || page_map_find(arena, ptr) != chunk)
+    {
+        pthread_mutex_unlock(&arena -> lock);
+        return 0;
+    }
+
+    struct chunk_t header = *chunk;
+    int checksum = header.checksum;
+    header.checksum = 0;
+    int suspicious = header.slab_flag || header.size > TCACHE_MAX_SIZE || checksum != add_bytes(&header, sizeof(struct chunk_t));
+    if (bytes && (bytes > header.size || header.size >= bytes + metadata_size)) suspicious = 1;
+    for (int i = 0; i < fence_size && !suspicious; i++)
+    {
+        if (*((char *)ptr - fence_size + i) != i) suspicious = 1;
+    }
+    if (suspicious)
+    {
+        pthread_mutex_unlock(&arena -> lock);
+        return 0;
+    }
+
+    thread_cache_mark(arena, chunk, 1);
+    uint32_t size = chunk -> size;
+    int line = chunk_line(arena, chunk);
+    const char * filename = chunk_filename(arena, chunk);
+    pthread_mutex_unlock(&arena -> lock);
+
+    if (threadCache.generation != heapGeneration)
+    {
+        memset(threadCache.counts, 0, sizeof(threadCache.counts));
+        threadCache.generation = heapGeneration;
+    }
+
+    thread_register();
+
+    //Full class gives its oldest blocks back to the heap in one batch
+    int class = (size - 1) >> 3;
+    if (threadCache.counts[class] == TCACHE_SLOTS)
+    {
+        profileParking++;
+        thread_cache_release(threadCache.slots[class], TCACHE_BATCH);
+        profileParking--;
+
+        memmove(threadCache.slots[class], threadCache.slots[class] + TCACHE_BATCH, (TCACHE_SLOTS - TCACHE_BATCH) * sizeof(void *));
+        memmove(threadCache.sizes[class], threadCache.sizes[class] + TCACHE_BATCH, (TCACHE_SLOTS - TCACHE_BATCH) * sizeof(uint32_t));
+        memmove(threadCache.lines[class], threadCache.lines[class] + TCACHE_BATCH, (TCACHE_SLOTS - TCACHE_BATCH) * sizeof(int));
+        memmove(threadCache.filenames[class], threadCache.filenames[class] + TCACHE_BATCH, (TCACHE_SLOTS - TCACHE_BATCH) * sizeof(const char *));
+        threadCache.counts[class] -= TCACHE_BATCH;
+    }
+
+    //A cached block is no longer live for the profile
+    profile_update(line, filename, -(int64_t)size, -1);
+
+    threadCache.sizes[class][threadCache.counts[class]] = size;
+    threadCache.lines[class][threadCache.counts[class]] = line;
+    threadCache.filenames[class][threadCache.counts[class]] = filename;
+    threadCache.slots[class][threadCache.counts[class]++] = ptr;
+    return 1;
+}
+
+void thread_cache_refill(struct arena_t * arena, size_t bytes, int line, const char * filename)
+{
+    //Called with the lock held right after a cache miss
+    //Allocates a batch of blocks of the same size so the next misses are served locally
+    if (!threadCacheEnabled || bytes > TCACHE_MAX_SIZE) return;
+
+    int class = (bytes - 1) >> 3;
+    if (threadCache.counts[class] > 0) return;
+
+    //The blocks count for the profile once they are handed out
+    profileParking++;
+    for (int i = 1; i < TCACHE_BATCH; i++)
+    {
+        void * ptr = allocate_block(arena, bytes, line, filename);
+        if (ptr == NULL) break;
+        thread_cache_mark(arena, (struct chunk_t *)((char *)ptr - move_to_data_block), 1);
+        threadCache.sizes[class][threadCache.counts[class]] = bytes;
+        threadCache.lines[class][threadCache.counts[class]] = line;
+        threadCache.filenames[class][threadCache.counts[class]] = filename;
+        threadCache.slots[class][threadCache.counts[class]++] = ptr;
+    }
+    profileParking--;
+}
+
+void thread_cache_flush(void)
+{
+    if (threadCache.generation != heapGeneration)
+    {
+        memset(threadCache.counts, 0, sizeof(threadCache.counts));
+        threadCache.generation = heapGeneration;
+        return;
+    }
+
+    profileParking++;
+    for (int class = 0; class < TCACHE_CLASS_COUNT; class++)
+    {
+        thread_cache_release(threadCache.slots[class], threadCache.counts[class]);
+        threadCache.counts[class] = 0;
+    }
+    profileParking--;
+}
+
+void thread_cache_mark(struct arena_t * arena, struct chunk_t * chunk, int cached)
+{
+    //Marks a block as waiting in a thread cache or clears the mark, the lock of the arena has to be held
+    chunk -> taken_flag = cached ? CHUNK_CACHED : 1;
+    chunk -> checksum = 0;
+    chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
+}
+
+void thread_cache_release(void ** pointers, int count)
+{
+    //Gives cached blocks back to their arenas like release_blocks, the mark of every block is cleared right before it is freed
+    struct arena_t * locked = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        struct arena_t * arena = arena_of(pointers[i]);
+        if (arena != locked)
+        {
+            if (locked) pthread_mutex_unlock(&locked -> lock);
+            locked = arena;
+            arena_lock(locked);
+        }
+
+        thread_cache_mark(arena, (struct chunk_t *)((char *)pointers[i] - move_to_data_block), 0);
+        release_block(arena, pointers[i]);
+    }
+    if (locked) pthread_mutex_unlock(&locked -> lock);
+}
+
+void * slab_alloc(struct arena_t * arena, size_t bytes, int line, const char * filename)
+{
+    //Takes the first free object of a slab of the size class, a new slab is carved from the heap when all are full
+    uint32_t class = (bytes - 1) >> 4;
+    struct slab_t * slab = arena -> slabs[class];
+    if (slab == NULL)
+    {
+        void * data = allocate_block(arena, SLAB_PAYLOAD, line, filename);
+        if (data == NULL) return NULL;
+
+        //The slab page stops counting as a block, its objects count instead
+        struct chunk_t * chunk = (struct chunk_t *)((char *)data - move_to_data_block);
+        size_index_remove(&arena -> used_sizes, chunk -> size);
+        chunk -> slab_flag = 1;
+        chunk -> checksum = 0;
+        chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
+
+        slab = data;
+        memset(slab, 0, sizeof(struct slab_t));
+        slab -> class = class;
+        slab -> object_size = (class + 1) << 4;
+        slab -> capacity = (SLAB_PAYLOAD - sizeof(struct slab_t)) / slab -> object_size;
+        slab -> free_count = slab -> capacity;
+        for (uint32_t i = 0; i < slab -> capacity; i++) slab -> free_map[i >> 6] |= (uint64_t)1 << (i & 63);
+
+        arena -> slabs[class] = slab;
+        arena -> slab_free_space += (size_t)slab -> capacity * slab -> object_size;
+    }
+
+    int word = 0;
+    while (slab -> free_map[word] == 0) word++;
+    int index = (word << 6) + __builtin_ctzl(slab -> free_map[word]);
+    slab -> free_map[word] &= slab -> free_map[word] - 1;
+    size_index_add(&arena -> used_sizes, slab -> object_size);
+    arena -> slab_free_space -= slab -> object_size;
+
+    //Full slabs leave the list until an object is freed
+    if (--slab -> free_count == 0)
+    {
+        arena -> slabs[class] = slab -> next;
+        if (slab -> next) slab -> next -> prev = NULL;
+        slab -> next = NULL;
+    }
+
+    return (char *)slab + sizeof(struct slab_t) + (size_t)index * slab -> object_size;
+}
+
+void slab_free(struct arena_t * arena, struct chunk_t * chunk, void * ptr)
+{
+    //Caller made sure ptr is the start of an object in use
+    struct slab_t * slab = slab_of(chunk);
+    uint32_t index = ((char *)ptr - ((char *)slab + sizeof(struct slab_t))) / slab -> object_size;
+    slab -> free_map[index >> 6] |= (uint64_t)1 << (index & 63);
+    size_index_remove(&arena -> used_sizes, slab -> object_size);
+    arena -> slab_free_space += slab -> object_size;
+
+    if (slab -> free_count++ == 0)
+    {
+        slab -> prev = NULL;
+        slab -> next = arena -> slabs[slab -> class];
+        if (slab -> next) slab -> next -> prev = slab;
+        arena -> slabs[slab -> class] = slab;
+    }
+
+    if (slab -> free_count < slab -> capacity) return;
+
+    //Empty slabs go back to the heap as an ordinary block
+    if (slab -> prev) slab -> prev -> next = slab -> next;
+    else arena -> slabs[slab -> class] = slab -> next;
+    if (slab -> next) slab -> next -> prev = slab -> prev;
+
+    arena -> slab_free_space -= (size_t)slab -> capacity * slab -> object_size;
+    size_index_add(&arena -> used_sizes, chunk -> size);
+    chunk -> slab_flag = 0;
+    chunk -> checksum = 0;
+    chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
+    release_block(arena, slab);
+}
+
+struct slab_t * slab_of(struct chunk_t * chunk)
+{
+    return (struct slab_t *)((char *)chunk + move_to_data_block);
+}
+
+enum pointer_type_t slab_pointer_type(struct chunk_t * chunk, const void * pointer)
+{
+    //Pointer lies in the payload of a slab chunk
+    struct slab_t * slab = slab_of(chunk);
+    char * objects = (char *)slab + sizeof(struct slab_t);
+    if ((char *)pointer < objects) return pointer_control_block;
+
+    size_t index = ((char *)pointer - objects) / slab -> object_size;
+    if (index >= slab -> capacity) return pointer_inside_data_block;
+    if (pointer != objects + index * slab -> object_size) return pointer_inside_data_block;
+
+    return (slab -> free_map[index >> 6] >> (index & 63)) & 1 ? pointer_unallocated : pointer_valid;
+}
+
+void * mapping_alloc(size_t bytes, int line, const char * filename)
+{
+    //The block gets a mapping of its own, laid out like a heap holding a single chunk
+    size_t length = page_size(bytes + metadata_size);
+    struct chunk_t * chunk = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) return NULL;
+
+    memset(chunk, 0, sizeof(struct chunk_t));
+    chunk_set_prev(chunk, NULL);
+    chunk_set_next(chunk, NULL);
+    chunk_init_site(chunk);
+    chunk -> size = bytes;
+    chunk -> taken_flag = 1;
+    chunk -> checksum = 0;
+    chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
+
+    for (int i = 0; i < fence_size; i++)
+    {
+        *((char *)chunk + sizeof(struct chunk_t) + i) = i;
+        *((char *)chunk + move_to_data_block + bytes + i) = i;
+    }
+
+    pthread_mutex_lock(&mappingsMutex);
+    if (mappingCount == HEAP_MAX_MAPPINGS)
+    {
+        pthread_mutex_unlock(&mappingsMutex);
+        munmap(chunk, length);
+        return NULL;
+    }
+
+    int index = mappingCount;
+    while (index > 0 && (char *)mappings[index - 1].chunk > (char *)chunk) index--;
+    memmove(&mappings[index + 1], &mappings[index], (mappingCount - index) * sizeof(struct mapping_t));
+    mappings[index] = (struct mapping_t){chunk, length, line, filename};
+    mappingCount++;
+    size_index_add(&mappingSizes, bytes);
+    mappedBytes += length;
+    profile_update(line, filename, bytes, 1);
+    pthread_mutex_unlock(&mappingsMutex);
+
+    return (char *)chunk + move_to_data_block;
+}
+
+int mapping_find(const void * pointer)
+{
+    //Binary search over the sorted registry, the caller holds mappingsMutex
+    int low = 0, high = mappingCount - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        char * start = (char *)mappings[middle].chunk;
+        if ((char *)pointer < start) high = middle - 1;
+        else if ((char *)pointer >= start + mappings[middle].length) low = middle + 1;
+        else return middle;
+    }
+    return -1;
+}
+
+void * mapping_resize(void * ptr, size_t new_size)
+{
+    //Lets the kernel move the pages of a mapped block instead of copying them
+    //Returns the new address of the data or NULL when ptr isn't a mapped block or mremap failed
+    pthread_mutex_lock(&mappingsMutex);
+    int index = mapping_find(ptr);
+    if (index < 0 || ptr != (char *)mappings[index].chunk + move_to_data_block || new_size > CHUNK_MAX_SIZE)
+    {
+        pthread_mutex_unlock(&mappingsMutex);
+        return NULL;
+    }
+
+    struct mapping_t mapping = mappings[index];
+    if (validationMode != validation_off && mapping_validate(&mapping) < 0)
+    {
+        pthread_mutex_unlock(&mappingsMutex);
+        heap_message("Detected heap integrity breach during heap_realloc\n");
+        return NULL;
+    }
+
+    size_t length = page_size(new_size + metadata_size);
+    struct chunk_t * chunk = mapping.chunk;
+    size_t old_size = chunk -> size;
+    if (length != mapping.length)
+    {
+        chunk = mremap(mapping.chunk, mapping.length, length, MREMAP_MAYMOVE);
+        if (chunk == MAP_FAILED)
+        {
+            pthread_mutex_unlock(&mappingsMutex);
+            return NULL;
+        }
+    }
+
+    chunk -> size = new_size;
+    chunk -> checksum = 0;
+    chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
+    for (int i = 0; i < fence_size; i++)
+    {
+        *((char *)chunk + move_to_data_block + new_size + i) = i;
+    }
+
+    //The registry stays sorted when the mapping moved
+    memmove(&mappings[index], &mappings[index + 1], (mappingCount - index - 1) * sizeof(struct mapping_t));
+    index = mappingCount - 1;
+    while (index > 0 && (char *)mappings[index - 1].chunk > (char *)chunk) index--;
+    memmove(&mappings[index + 1], &mappings[index], (mappingCount - 1 - index) * sizeof(struct mapping_t));
+    mappings[index] = (struct mapping_t){chunk, length, mapping.line, mapping.filename};
+    size_index_remove(&mappingSizes, old_size);
+    size_index_add(&mappingSizes, new_size);
+    mappedBytes += length - mapping.length;
+    profile_update(mapping.line, mapping.filename, (int64_t)new_size - (int64_t)old_size, 0);
+    pthread_mutex_unlock(&mappingsMutex);
+
+    return (char *)chunk + move_to_data_block;
+}
+
+int mapping_release(void * ptr)
+{
+    //Returns 1 when ptr was a block with its own mapping and it was unmapped
+    pthread_mutex_lock(&mappingsMutex);
+    int index = mapping_find(ptr);
+    if (index < 0 || ptr != (char *)mappings[index].chunk + move_to_data_block)
+    {
+        pthread_mutex_unlock(&mappingsMutex);
+        return 0;
+    }
+
+    struct mapping_t mapping = mappings[index];
+    if (validationMode != validation_off && mapping_validate(&mapping) < 0)
+    {
+        pthread_mutex_unlock(&mappingsMutex);
+        heap_message("Detected heap integrity breach during heap_free\n");
+        return 1;
+    }
+
+    memmove(&mappings[index], &mappings[index + 1], (mappingCount - index - 1) * sizeof(struct mapping_t));
+    mappingCount--;
+    size_index_remove(&mappingSizes, mapping.chunk -> size);
+    mappedBytes -= mapping.length;
+    profile_update(mapping.line, mapping.filename, -(int64_t)mapping.chunk -> size, -1);
+    pthread_mutex_unlock(&mappingsMutex);
+
+    munmap(mapping.chunk, mapping.length);
+    return 1;
+}
+
+void mapping_release_all(void)
+{
+    pthread_mutex_lock(&mappingsMutex);
+    for (int i = 0; i < mappingCount; i++)
+    {
+        munmap(mappings[i].chunk, mappings[i].length);
+    }
+    mappingCount = 0;
+    size_index_clear(&mappingSizes);
+    mappedBytes = 0;
+    pthread_mutex_unlock(&mappingsMutex);
+}
+
+enum pointer_type_t mapping_pointer_type(const void * pointer)
+{
+    //Same classification as inside an arena, pointers outside every mapping are out of heap
+    pthread_mutex_lock(&mappingsMutex);
+    int index = mapping_find(pointer);
+    enum pointer_type_t res = pointer_out_of_heap;
+    if (index >= 0)
+    {
+        char * chunk = (char *)mappings[index].chunk;
+        char * data = chunk + move_to_data_block;
+        if ((char *)pointer == data) res = pointer_valid;
+        else if ((char *)pointer > data && (char *)pointer <= data + mappings[index].chunk -> size) res = pointer_inside_data_block;
+        else if ((char *)pointer < data) res = pointer_control_block;
+        else res = pointer_null;
+    }
+    pthread_mutex_unlock(&mappingsMutex);
+    return res;
+}
+
+void * mapping_data_block_start(const void * pointer)
+{
+    enum pointer_type_t type = mapping_pointer_type(pointer);
+    if (type != pointer_valid && type != pointer_inside_data_block) return NULL;
+
+    pthread_mutex_lock(&mappingsMutex);
+    int index = mapping_find(pointer);
+    void * res = index >= 0 ? mappings[index].chunk : NULL;
+    pthread_mutex_unlock(&mappingsMutex);
+    return res;
+}
+
+int mapping_validate(struct mapping_t * mapping)
+{
+    //Header and fences of a mapped block, returns -3 like arena_validate
+    __atomic_add_fetch(&validationCount, 1, __ATOMIC_RELAXED);
+
+    struct chunk_t * chunk = mapping -> chunk;
+    int tempChecksum = chunk -> checksum;
+    chunk -> checksum = 0;
+    if (tempChecksum != add_bytes(chunk, sizeof(struct chunk_t))) {heap_message("Mapped block checksum is incorrect\n"); return -3;}
+    chunk -> checksum = tempChecksum;
+
+    if (chunk -> taken_flag != 1 || chunk_next(chunk) != NULL || chunk_prev(chunk) != NULL) {heap_message("Mapped block header is incorrect\n"); return -3;}
+    if (chunk -> size + metadata_size > mapping -> length) {heap_message("Mapped block is larger than its mapping\n"); return -3;}
+
+    for (int i = 0; i < fence_size; i++)
+    {
+        if (*((char *)chunk + sizeof(struct chunk_t) + i) != i) {heap_message("Mapped block left fence is incorrect\n"); return -3;}
+        if (*((char *)chunk + move_to_data_block + chunk -> size + i) != i) {heap_message("Mapped block right fence is incorrect\n"); return -3;}
+    }
+    return 0;
+}
+
+int mappings_validate(void)
+{
+    int res = 0;
+    pthread_mutex_lock(&mappingsMutex);
+    for (int i = 0; i < mappingCount && res == 0; i++)
+    {
+        res = mapping_validate(&mappings[i]);
+    }
+    pthread_mutex_unlock(&mappingsMutex);
+    return res;
+}
+
+void mappings_get_stats(struct heap_arena_stats_t * stats)
+{
+    //Mapped blocks are used from the first to the last byte of their mapping
+    pthread_mutex_lock(&mappingsMutex);
+    stats -> heap_size += mappedBytes;
+    stats -> used_space += mappedBytes;
+    stats -> used_blocks_count += mappingCount;
+    size_t largest = size_index_max(&mappingSizes);
+    if (largest > stats -> largest_used_block_size) stats -> largest_used_block_size = largest;
+    pthread_mutex_unlock(&mappingsMutex);
+}
+
+void heap_set_mmap_threshold(size_t bytes)
+{
+    mmapThreshold = bytes;
+}
+
+void heap_set_slab(int enabled)
+{
+    //Small sizes move from the thread caches to the slabs, blocks cached so far go back to the heap
+    if (enabled) thread_cache_flush();
+    slabEnabled = enabled;
+}
+
+void heap_set_remote_free(int enabled)
+{
+    //Blocks already queued are still given back by the next thread taking the lock of their arena
+    remoteFreeEnabled = enabled;
+}
+
+void heap_set_thread_cache(int enabled)
+{
+    //Disabling the caches gives the blocks of the calling thread back right away
+    //Other threads give theirs back when they exit
+    if (!enabled) thread_cache_flush();
+    threadCacheEnabled = enabled;
+}
+
+void heap_dump_debug_information(void)
+{
+    if (heap_validate() < 0)
+    {
+        printf("Detected heap integrity breach in heap_dump_debug_information\n");
+        return;
+    }
+
+    for (int i = 0; i < HEAP_MAX_ARENAS; i++)
+    {
+        struct arena_t * arena = &arenas[i];
+        if (arena -> heap.heap == NULL) continue;
+
+        arena_lock(arena);
+        struct heap_arena_stats_t stats;
+        arena_get_stats(arena, &stats);
+
+        int chunk_counter = 0;
+        struct chunk_t * temp = arena -> heap.first_chunk;
+
+        printf("################################\n");
+        printf("HEAP STRUCT INFORMATION DUMP:\n");
+        printf("HEAP ARENA: %d\n", i);
+        printf("HEAP ADDRESS: %p\n", arena -> heap.heap);
+        printf("HEAP FIRST_CHUNK ADDRESS: %p\n", arena -> heap.first_chunk);
+        printf("HEAP CHECKSUM: %d\n", arena -> heap.checksum);
+        printf("HEAP CURRENT FREE SIZE: %lu\n", stats.free_space);
+        printf("HEAP MAX SIZE: %lu\n", arena -> heap.max_heap_size);
+        printf("HEAP CHUNKS IN USE: %lu\n", arena -> heap.chunk_count);
+        printf("HEAP MAX ADDRESS: %p\n", (void *)((char *)arena -> heap.heap + arena -> heap.max_heap_size));
+        printf("HEAP BIGGEST BLOCK: %lu\n", stats.largest_used_block_size);
+        printf("HEAP THREADS: %d\n", stats.threads);
+        printf("HEAP LOCK CONTENTION: %lu\n", stats.contention);
+        printf("################################\n");
+    
+        printf("\n");
+    
+        printf("################################\n");
+        printf("HEAP CHUNKS INFORMATION:\n");
+
+        while (temp)
+        {
+            printf("----------------------------------------\n");
+            printf("CHUNK NUMBER: %d\n", chunk_counter);
+            printf("CHUNK ADDRESS: %p\n", temp);
+            printf("CHUNK PREV ADDRESS: %p\n", chunk_prev(temp));
+            printf("CHUNK NEXT ADDRESS: %p\n", chunk_next(temp));
+            printf("CHUNK CHECKSUM: %d\n", temp -> checksum);
+            printf("CHUNK PAYLOAD SIZE: %lu\n", (unsigned long)temp -> size);
+            printf("CHUNK ACTUAL SIZE: %lu\n", (unsigned long)(temp -> size + metadata_size));
+            printf("CHUNK TAKEN FLAG: %d\n", temp -> taken_flag);
+            printf("CHUNK ALLOCATED IN LINE: %d\n", chunk_line(arena, temp));
+            printf("CHUNK ALLOCATED IN FILE: %s\n", chunk_filename(arena, temp));
+            if (temp -> slab_flag)
+            {
+                struct slab_t * slab = slab_of(temp);
+                printf("CHUNK SLAB OBJECT SIZE: %u\n", slab -> object_size);
+                printf("CHUNK SLAB OBJECTS IN USE: %u/%u\n", slab -> capacity - slab -> free_count, slab -> capacity);
+            }
+            printf("----------------------------------------\n");
+            printf("\n");
+            temp = chunk_next(temp);
+            chunk_counter++;
+        }
+    
+        printf("END OF CHUNKS\n");
+        printf("################################\n");
+        pthread_mutex_unlock(&arena -> lock);
+    }
+
+    pthread_mutex_lock(&mappingsMutex);
+    if (mappingCount > 0)
+    {
+        printf("################################\n");
+        printf("MAPPED BLOCKS INFORMATION:\n");
+        for (int i = 0; i < mappingCount; i++)
+        {
+            printf("----------------------------------------\n");
+            printf("MAPPED BLOCK ADDRESS: %p\n", mappings[i].chunk);
+            printf("MAPPED BLOCK PAYLOAD SIZE: %lu\n", (unsigned long)mappings[i].chunk -> size);
+            printf("MAPPED BLOCK MAPPING SIZE: %lu\n", mappings[i].length);
+            printf("MAPPED BLOCK ALLOCATED IN LINE: %d\n", mappings[i].line);
+            printf("MAPPED BLOCK ALLOCATED IN FILE: %s\n", mappings[i].filename);
+            printf("----------------------------------------\n");
+        }
+        printf("END OF MAPPED BLOCKS\n");
+        printf("################################\n");
+    }
+    pthread_mutex_unlock(&mappingsMutex);
+}
+
+int snapshot_write(int fd, const void * data, size_t length)
+{
+    //Writes everything or fails, short writes and signals are retried
+    const char * bytes = data;
+    while (length)
+    {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return -1;
+        bytes += written;
+        length -= written;
+    }
+    return 0;
+}
+
+int snapshot_section(int fd, uint32_t kind, int index, const void * start, uint64_t length, const void * records, uint64_t count)
+{
+    struct heap_snapshot_section_t section = {kind, index, (uintptr_t)start, length, count};
+    if (snapshot_write(fd, &section, sizeof(section)) < 0) return -1;
+    return count ? snapshot_write(fd, records, count * sizeof(struct heap_snapshot_record_t)) : 0;
+}
+
+int snapshot_filenames(int fd, const char ** filenames, size_t count)
+{
+    //Every filename once, records refer to them by the address the heap got them with
+    qsort(filenames, count, sizeof(const char *), snapshot_compare_filenames);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i == 0 || filenames[i] != filenames[i - 1]) filenames[unique++] = filenames[i];
+    }
+
+    struct heap_snapshot_section_t section = {snapshot_strings, 0, 0, 0, unique};
+    if (snapshot_write(fd, &section, sizeof(section)) < 0) return -1;
+    for (size_t i = 0; i < unique; i++)
+    {
+        struct heap_snapshot_string_t string = {(uintptr_t)filenames[i], strlen(filenames[i]), 0};
+        if (snapshot_write(fd, &string, sizeof(string)) < 0 || snapshot_write(fd, filenames[i], string.length) < 0) return -1;
+    }
+    return 0;
+}
+
+int snapshot_compare_filenames(const void * a, const void * b)
+{
+    uintptr_t x = (uintptr_t)*(const char * const *)a, y = (uintptr_t)*(const char * const *)b;
+    return (x > y) - (x < y);
+}
+
+int heap_write_snapshot(int fd)
+{
+    //Binary dump of every block, see struct heap_snapshot_header_t for the layout
+    //Every arena is copied while its lock is held and written once the lock is released
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    struct heap_snapshot_header_t header = {HEAP_SNAPSHOT_MAGIC, HEAP_SNAPSHOT_VERSION, metadata_size, (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, PAGE_SIZE, 0};
+    if (snapshot_write(fd, &header, sizeof(header)) < 0) return -1;
+
+    //Filenames of all records, written in one section at the end
+    const char ** filenames = NULL;
+    size_t filename_count = 0, filename_capacity = 0;
+    int res = 0;
+
+    for (int i = 0; i < HEAP_MAX_ARENAS + 1 && res == 0; i++)
+    {
+        struct heap_snapshot_record_t * records = NULL;
+        size_t count = 0, capacity = 0;
+        const void * start = NULL;
+        uint64_t length = 0;
+
+        if (i < HEAP_MAX_ARENAS)
+        {
+            struct arena_t * arena = &arenas[i];
+            arena_lock(arena);
+            if (arena -> heap.heap == NULL)
+            {
+                pthread_mutex_unlock(&arena -> lock);
+                continue;
+            }
+
+            capacity = arena -> heap.chunk_count;
+            records = mmap(NULL, capacity * sizeof(struct heap_snapshot_record_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (records == MAP_FAILED)
+            {
+                pthread_mutex_unlock(&arena -> lock);
+                res = -1;
+                break;
+            }
+
+            for (struct chunk_t * chunk = arena -> heap.first_chunk; chunk && count < capacity; chunk = chunk_next(chunk))
+            {
+                struct heap_snapshot_record_t * record = &records[count++];
+                *record = (struct heap_snapshot_record_t){(uintptr_t)chunk, 0, chunk -> size, 0, 0, 0};
+                if (chunk -> taken_flag)
+                {
+                    record -> flags = SNAPSHOT_TAKEN | (chunk -> slab_flag ? SNAPSHOT_SLAB : 0);
+                    record -> filename = (uintptr_t)chunk_filename(arena, chunk);
+                    record -> line = chunk_line(arena, chunk);
+                    if (chunk -> slab_flag) record -> objects = slab_of(chunk) -> capacity - slab_of(chunk) -> free_count;
+                }
+            }
+            start = arena -> heap.heap;
+            length = arena -> heap.max_heap_size;
+            pthread_mutex_unlock(&arena -> lock);
+        }
+        else
+        {
+            pthread_mutex_lock(&mappingsMutex);
+            capacity = mappingCount;
+            if (capacity)
+            {
+                records = mmap(NULL, capacity * sizeof(struct heap_snapshot_record_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (records == MAP_FAILED)
+                {
+                    pthread_mutex_unlock(&mappingsMutex);
+                    res = -1;
+                    break;
+                }
+            }
+            for (int m = 0; m < mappingCount; m++)
+            {
+                records[count++] = (struct heap_snapshot_record_t){(uintptr_t)mappings[m].chunk, (uintptr_t)mappings[m].filename,
+                    mappings[m].chunk -> size, mappings[m].line, SNAPSHOT_TAKEN | SNAPSHOT_MAPPED, 0};
+                length += mappings[m].length;
+            }
+            pthread_mutex_unlock(&mappingsMutex);
+        }
+
+        res = snapshot_section(fd, i < HEAP_MAX_ARENAS ? snapshot_arena : snapshot_mappings, i, start, length, records, count);
+
+        //Filenames are string literals, so their addresses stay valid once the lock is gone
+        for (size_t r = 0; r < count && res == 0; r++)
+        {
+            if (records[r].filename == 0) continue;
+            if (filename_count == filename_capacity)
+            {
+                size_t grown = filename_capacity ? filename_capacity * 2 : PAGE_SIZE / sizeof(const char *);
+                const char ** copy = mmap(NULL, grown * sizeof(const char *), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (copy == MAP_FAILED)
+                {
+                    res = -1;
+                    break;
+                }
+                if (filenames)
+                {
+                    memcpy(copy, filenames, filename_count * sizeof(const char *));
+                    munmap(filenames, filename_capacity * sizeof(const char *));
+                }
+                filenames = copy;
+                filename_capacity = grown;
+            }
+            filenames[filename_count++] = (const char *)(uintptr_t)records[r].filename;
+        }
+        if (records) munmap(records, capacity * sizeof(struct heap_snapshot_record_t));
+    }
+
+    if (res == 0) res = snapshot_filenames(fd, filenames, filename_count);
+    if (res == 0) res = snapshot_section(fd, snapshot_end, 0, NULL, 0, NULL, 0);
+    if (filenames) munmap(filenames, filename_capacity * sizeof(const char *));
+    return res;
+}
+
+uint64_t latency_now(void)
+{
+    //Cycles where the time stamp counter is available, nanoseconds elsewhere
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+uint64_t latency_start(void)
+{
+    //0 stands for no measurement, so a disabled tracker costs one branch per phase
+    return latencyEnabled ? latency_now() | 1 : 0;
+}
+
+void latency_record(enum latency_kind_t kind, uint64_t start)
+{
+    if (start == 0) return;
+    uint64_t ticks = latency_now() - start;
+
+    struct latency_table_t * table = latency_table();
+    if (table == NULL) return;
+
+    //Bucket i holds the times below 2^i ticks which don't fit in bucket i - 1
+    size_t bucket = ticks ? 64 - __builtin_clzll(ticks) : 0;
+    if (bucket >= LATENCY_BUCKET_COUNT) bucket = LATENCY_BUCKET_COUNT - 1;
+
+    struct latency_histogram_t * histogram = &table -> histograms[kind];
+    histogram -> counts[bucket]++;
+    histogram -> samples++;
+    histogram -> total_ticks += ticks;
+    if (ticks > histogram -> max_ticks) histogram -> max_ticks = ticks;
+}
+
+uint64_t latency_enter(void)
+{
+    if (!latencyEnabled) return 0;
+    return latencyDepth++ ? 0 : latency_now() | 1;
+}
+
+void latency_leave(enum latency_kind_t kind, uint64_t start)
+{
+    //Only the outermost public function of a thread records its time
+    if (start == 0) return;
+    latencyDepth = 0;
+    latency_record(kind, start);
+}
+
+struct latency_table_t * latency_table(void)
+{
+    if (latencyTable) return latencyTable;
+
+    //Tables of exited threads are taken over first, their counts stay in the merged histograms
+    pthread_mutex_lock(&latencyMutex);
+    struct latency_table_t * table = latencyTables;
+    while (table && table -> owned) table = table -> next;
+    if (table == NULL)
+    {
+        table = mmap(NULL, sizeof(struct latency_table_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (table == MAP_FAILED) table = NULL;
+        else
+        {
+            table -> next = latencyTables;
+            latencyTables = table;
+        }
+    }
+    if (table) table -> owned = 1;
+    pthread_mutex_unlock(&latencyMutex);
+
+    latencyTable = table;
+    if (table) thread_register();
+    return table;
+}
+
+void latency_table_release(void)
+{
+    if (latencyTable == NULL) return;
+
+    pthread_mutex_lock(&latencyMutex);
+    latencyTable -> owned = 0;
+    pthread_mutex_unlock(&latencyMutex);
+    latencyTable = NULL;
+}
+
+void heap_set_latency_tracking(int enabled)
+{
+    latencyEnabled = enabled;
+}
+
+int heap_get_latency_histogram(enum latency_kind_t kind, struct latency_histogram_t * histogram)
+{
+    //Sums the tables of all threads, counts of threads still running may be a few operations behind
+    if (histogram == NULL || kind < 0 || kind >= LATENCY_KIND_COUNT) return -1;
+    memset(histogram, 0, sizeof(*histogram));
+
+    pthread_mutex_lock(&latencyMutex);
+    for (struct latency_table_t * table = latencyTables; table; table = table -> next)
+    {
+        const struct latency_histogram_t * part = &table -> histograms[kind];
+        for (int i = 0; i < LATENCY_BUCKET_COUNT; i++) histogram -> counts[i] += __atomic_load_n(&part -> counts[i], __ATOMIC_RELAXED);
+        histogram -> samples += __atomic_load_n(&part -> samples, __ATOMIC_RELAXED);
+        histogram -> total_ticks += __atomic_load_n(&part -> total_ticks, __ATOMIC_RELAXED);
+        uint64_t max_ticks = __atomic_load_n(&part -> max_ticks, __ATOMIC_RELAXED);
+        if (max_ticks > histogram -> max_ticks) histogram -> max_ticks = max_ticks;
+    }
+    pthread_mutex_unlock(&latencyMutex);
+    return 0;
+}
+
+uint64_t heap_latency_percentile(const struct latency_histogram_t * histogram, double fraction)
+{
+    //Upper bound of the bucket holding the given fraction of the samples
+    if (histogram == NULL || histogram -> samples == 0) return 0;
+
+    uint64_t rank = (uint64_t)(fraction * histogram -> samples);
+    if (rank >= histogram -> samples) rank = histogram -> samples - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKET_COUNT; i++)
+    {
+        seen += histogram -> counts[i];
+        if (seen > rank) return i == 0 ? 0 : ((uint64_t)1 << i) - 1;
+    }
+    return histogram -> max_ticks;
+}
+
+void heap_reset_latency_histograms(void)
+{
+    //Counts recorded while the tables are cleared may survive, call it while the heap is quiet
+    pthread_mutex_lock(&latencyMutex);
+    for (struct latency_table_t * table = latencyTables; table; table = table -> next)
+    {
+        memset(table -> histograms, 0, sizeof(table -> histograms));
+    }
+    pthread_mutex_unlock(&latencyMutex);
+}
+
+void heap_dump_latency_histograms(void)
+{
+    printf("################################\n");
+    printf("HEAP LATENCY HISTOGRAMS (ticks):\n");
+    for (int kind = 0; kind < LATENCY_KIND_COUNT; kind++)
+    {
+        struct latency_histogram_t histogram;
+        heap_get_latency_histogram(kind, &histogram);
+        if (histogram.samples == 0) continue;
+
+        printf("----------------------------------------\n");
+        printf("%s: samples %lu, mean %lu, p50 %lu, p99 %lu, p999 %lu, max %lu\n", latencyNames[kind],
+            (unsigned long)histogram.samples, (unsigned long)(histogram.total_ticks / histogram.samples),
+            (unsigned long)heap_latency_percentile(&histogram, 0.5), (unsigned long)heap_latency_percentile(&histogram, 0.99),
+            (unsigned long)heap_latency_percentile(&histogram, 0.999), (unsigned long)histogram.max_ticks);
+        for (int i = 0; i < LATENCY_BUCKET_COUNT; i++)
+        {
+            if (histogram.counts[i] == 0) continue;
+            printf("  < 2^%-2d %lu\n", i, (unsigned long)histogram.counts[i]);
+        }
+    }
+    printf("################################\n");
+}
+
+void * allocate_block(struct arena_t * arena, size_t bytes, int line, const char * filename)
+{
+    //Malloc code here with bonus information about blocks allocated or failures
+    if (!bytes) 
+    {
+        heap_message("Called malloc with 0 amount of bytes\n");
+        heap_message("Malloc called in line: %d\nAnd filename: %s\n", line, filename);        
+        return NULL;
+    }
+
+    if (bytes + sizeof(struct chunk_t) < bytes || bytes > CHUNK_MAX_SIZE)
+    {
+        heap_message("Called malloc with negative amount of bytes\n");
+        heap_message("Malloc called in line: %d\nAnd filename: %s\n", line, filename);        
+        return NULL;
+    }
+
+    if (arena_check(arena) < 0)
+    {
+        heap_message("Detected heap integrity breach\n");
+        heap_message("Malloc called in line: %d\nAnd filename: %s\n", line, filename);
+        return NULL;
+    }
+
+    //Add a new block of requested size to the heap and return pointer to the data block
+    char fence[fence_size];
+    for (int i = 0; i < fence_size; i++)
+    {
+        fence[i] = i;
+    }
+
+    //Function returns a freed block of at least required space if such exists
+    //It is also responsible for splitting blocks
+
+    struct chunk_t * suitableBlock;
+    suitableBlock = find_suitable_block(arena, bytes);
+    
+    //If NULL was returned we failed to find a suitable block
+    //Check if we have enough space to push the block at the "end" of the heap
+    //If not ask OS for more memory and put the block there
+    if (suitableBlock == NULL)
+    {
+        struct chunk_t * last_block = heap_get_last_block(arena);
+        if (chunk_check(arena, last_block) < 0)
+        {
+            heap_message("Detected heap integrity breach at the end of heap\n");
+            return NULL;
+        }
+        
+        if (((char *)arena -> heap.heap + arena -> heap.max_heap_size) - ((char *)last_block + last_block -> size) <= (bytes + metadata_size))
+        {
+            //A new block behind a block in use needs room for the metadata of its split off tail as well
+            size_t grow = page_size(bytes + metadata_size * 2);
+            uint64_t start = latency_start();
+            void * res = arena_sbrk(arena, grow);
+            latency_record(latency_grow, start);
+            if (res == ((void *)-1))
+            {
+                heap_message("Couldn't request more memory from OS\n");
+                heap_message("Malloc called in line: %d\nAnd filename: %s\n", line, filename);
+                return NULL;
+            }
+
+            arena -> heap.max_heap_size += grow;
+            arena -> heap.checksum = 0;
+            arena -> heap.checksum = add_bytes(&arena -> heap, sizeof(heap));
 
             //The last block could be taken if it matches perfectly the heap size
-            if (last_block -> taken_flag == 1)
+            if (last_block -> taken_flag)
             {
+                struct chunk_t firstChunk;
                 //Create a new free block with the payload of new memory granted by OS - metadata size
                 //This should be returned by find_suitable_block later
-                firstChunk.filename = __FILE__;
-                firstChunk.line = __LINE__;
-                firstChunk.next = NULL;
-                firstChunk.prev = last_block;
-                firstChunk.size = page_size(bytes + metadata_size) - metadata_size;
+                memset(&firstChunk, 0, sizeof(firstChunk));
+                chunk_init_site(&firstChunk);
+                chunk_set_next(&firstChunk, NULL);
+                chunk_set_prev(&firstChunk, last_block);
+                firstChunk.size = grow - metadata_size;
                 firstChunk.taken_flag = 0;
+                firstChunk.slab_flag = 0;
                 firstChunk.checksum = 0;
                 firstChunk.checksum = add_bytes(&firstChunk, sizeof(struct chunk_t));
 
                 //Update last block structure
-                last_block -> next = (struct chunk_t *)next_block(last_block);
+                chunk_set_next(last_block, (struct chunk_t *)next_block(last_block));
                 last_block -> checksum = 0;
                 last_block -> checksum = add_bytes(last_block, sizeof(struct chunk_t));
                 
                 //Append the new block at the end of last_block
-                memcpy(last_block -> next, &firstChunk, sizeof(struct chunk_t));
+                memcpy(next_block(last_block), &firstChunk, sizeof(struct chunk_t));
 
                 //Append fences
                 memcpy(next_block(last_block) + sizeof(struct chunk_t), fence, fence_size);
                 memcpy(next_block(last_block) + move_to_data_block + firstChunk.size, fence, fence_size);
+                page_map_add(arena, chunk_next(last_block));
+                bin_insert(arena, chunk_next(last_block));
+
+                arena -> heap.chunk_count++;
+                arena -> heap.checksum = 0;
+                arena -> heap.checksum = add_bytes(&arena -> heap, sizeof(heap));
             }
             else
             {
-                last_block -> size += page_size(bytes + metadata_size);
+                bin_remove(arena, last_block);
+                last_block -> size += grow;
                 last_block -> checksum = 0;
                 last_block -> checksum = add_bytes(last_block, sizeof(struct chunk_t));
+                bin_insert(arena, last_block);
                 //Update the right fence
                 memcpy(((char *)last_block + move_to_data_block + last_block -> size), fence, sizeof(fence));
             }
         }
 
         //It has to find a free block now
-        suitableBlock = find_suitable_block(bytes);
+        suitableBlock = find_suitable_block(arena, bytes);
         if (suitableBlock == NULL) 
         {
-            printf("Something went wrong in MALLOC\n");
-            pthread_mutex_unlock(&myMutex);
-            return NULL;
+            heap_message("Something went wrong in MALLOC\n");
+            return NULL;
+        }
+
+        suitableBlock -> size = bytes;
+        suitableBlock -> taken_flag = 1;
+        size_index_add(&arena -> used_sizes, bytes);
+        chunk_set_site(arena, suitableBlock, line, filename);
+        profile_update(line, filename, bytes, 1);
+        suitableBlock -> checksum = 0;
+        suitableBlock -> checksum = add_bytes(suitableBlock, sizeof(struct chunk_t));
+        
+        return (((char *)suitableBlock) + move_to_data_block);
+    }
+
+    //Suitable block is the arena -> heap.first_chunk it was partially initialised in the setup function
+    //So we don't require the whole malloc algorithm
+    if (suitableBlock == arena -> heap.heap)
+    {
+        suitableBlock -> size = bytes;
+        suitableBlock -> taken_flag = 1;
+        size_index_add(&arena -> used_sizes, bytes);
+        chunk_set_site(arena, suitableBlock, line, filename);
+        profile_update(line, filename, bytes, 1);
+        suitableBlock -> checksum = 0;
+        suitableBlock -> checksum = add_bytes(suitableBlock, sizeof(struct chunk_t));
+
+        memcpy(((char *)suitableBlock) + sizeof(struct chunk_t), fence, sizeof(fence));
+        memcpy(((char *)suitableBlock) + sizeof(struct chunk_t) + sizeof(fence) + bytes, fence, sizeof(fence));
+
+        return (((char *)suitableBlock) + move_to_data_block);
+
+    }
+    else //Suitable block is a free block
+    {
+        suitableBlock -> size = bytes;
+        suitableBlock -> taken_flag = 1;
+        size_index_add(&arena -> used_sizes, bytes);
+        chunk_set_site(arena, suitableBlock, line, filename);
+        profile_update(line, filename, bytes, 1);
+        suitableBlock -> checksum = 0;
+        suitableBlock -> checksum = add_bytes(suitableBlock, sizeof(struct chunk_t));
+
+        //We now only need to modify the position of the right side fence
+        memcpy(((char *)suitableBlock) + suitableBlock->size + metadata_size - fence_size, fence, sizeof(fence));
+
+        return (((char *)suitableBlock) + move_to_data_block);
+    }
+}
+
+void * heap_malloc_debug(size_t bytes, int line, const char * filename)
+{
+    uint64_t start = latency_enter();
+    void * ptr = malloc_request(bytes, line, filename);
+    latency_leave(latency_malloc, start);
+    sample_allocation(ptr, bytes, line, filename);
+    return ptr;
+}
+
+void * malloc_request(size_t bytes, int line, const char * filename)
+{
+    void * ptr = NULL;
+    if (mmapThreshold && bytes >= mmapThreshold && bytes <= CHUNK_MAX_SIZE)
+    {
+        //Falls through to the heap when the registry is full or mmap fails
+        ptr = mapping_alloc(bytes, line, filename);
+        if (ptr) return ptr;
+    }
+
+    if (slabEnabled && bytes > 0 && bytes <= SLAB_MAX_SIZE)
+    {
+        struct arena_t * arena = lock_thread_arena();
+        if (arena == NULL) return NULL;
+
+        if (arena_check(arena) < 0) heap_message("Detected heap integrity breach\nMalloc called in line: %d\nAnd filename: %s\n", line, filename);
+        else ptr = slab_alloc(arena, bytes, line, filename);
+        pthread_mutex_unlock(&arena -> lock);
+        return ptr;
+    }
+
+    ptr = thread_cache_get(bytes);
+    if (ptr) return ptr;
+
+    struct arena_t * arena = lock_thread_arena();
+    if (arena == NULL) return NULL;
+
+    ptr = allocate_block(arena, bytes, line, filename);
+    if (ptr) thread_cache_refill(arena, bytes, line, filename);
+    pthread_mutex_unlock(&arena -> lock);
+    return ptr;
+}
+
+size_t heap_malloc_batch_debug(size_t bytes, size_t count, void ** pointers, int line, const char * filename)
+{
+    //Allocates count blocks of bytes each under a single lock, returns count or 0 when any of them failed
+    if (count == 0 || pointers == NULL) return 0;
+    if (bytes == 0 || bytes > CHUNK_MAX_SIZE)
+    {
+        heap_message("Malloc batch given a size of 0 or larger than a chunk\n");
+        heap_message("Malloc batch called in line: %d\nAnd filename: %s\n", line, filename);
+        return 0;
+    }
+
+    size_t done = 0;
+    if (mmapThreshold && bytes >= mmapThreshold)
+    {
+        //Mapped blocks don't share a region to carve from
+        for (; done < count; done++)
+        {
+            pointers[done] = malloc_request(bytes, line, filename);
+            if (pointers[done] == NULL) break;
         }
-
-        suitableBlock -> size = bytes;
-        suitableBlock -> taken_flag = 1;
-        suitableBlock -> line = line;
-        suitableBlock -> filename = filename;
-        suitableBlock -> checksum = 0;
-        suitableBlock -> checksum = add_bytes(suitableBlock, sizeof(struct chunk_t));
-        
-        pthread_mutex_unlock(&myMutex);
-        return (((char *)suitableBlock) + move_to_data_block);
     }
-
-    //Suitable block is the myHeap.first_chunk it was partially initialised in the setup function
-    //So we don't require the whole malloc algorithm
-    if (suitableBlock == myHeap.heap || (suitableBlock == NULL && myHeap.chunk_count == 0))
+    else
     {
-        //If suitableBlock == NULL then first request for malloc was bigger than initial heap size
-        if (suitableBlock == NULL) 
+        struct arena_t * arena = lock_thread_arena();
+        if (arena == NULL) return 0;
+
+        if (slabEnabled && bytes <= SLAB_MAX_SIZE)
         {
-            suitableBlock = myHeap.heap;
-            void * res = custom_sbrk(page_size(bytes + metadata_size));
-            if (res == ((void *)-1))
+            if (arena_check(arena) < 0) heap_message("Detected heap integrity breach\nMalloc called in line: %d\nAnd filename: %s\n", line, filename);
+            else for (; done < count; done++)
             {
-                printf("Couldn't request more memory from OS\n");
-                printf("Malloc called in line: %d\nAnd filename: %s\n", line, filename);
-                pthread_mutex_unlock(&myMutex);
-                return NULL;
+                pointers[done] = slab_alloc(arena, bytes, line, filename);
+                if (pointers[done] == NULL) break;
             }
+        }
+        else
+        {
+            //One block holds as many payloads and their metadata as fit in a chunk and is cut into consecutive blocks
+            size_t per_chunk = (CHUNK_MAX_SIZE + metadata_size) / (bytes + metadata_size);
+            while (done < count)
+            {
+                size_t group = count - done < per_chunk ? count - done : per_chunk;
+                void * ptr = allocate_block(arena, group * (bytes + metadata_size) - metadata_size, line, filename);
+                if (ptr == NULL) break;
 
-            myHeap.max_heap_size += page_size(bytes + metadata_size);
-            myHeap.checksum = 0;
-            myHeap.checksum = add_bytes(&myHeap, sizeof(myHeap));
-
-            suitableBlock -> size += page_size(bytes + metadata_size);
-            suitableBlock -> checksum = 0;
-            suitableBlock -> checksum = add_bytes(suitableBlock, sizeof(struct chunk_t));
-            
-            suitableBlock = find_suitable_block(bytes);
+                carve_blocks(arena, (struct chunk_t *)((char *)ptr - move_to_data_block), bytes, group, pointers + done, line, filename);
+                done += group;
+            }
         }
+        pthread_mutex_unlock(&arena -> lock);
+    }
 
-        suitableBlock -> size = bytes;
-        suitableBlock -> taken_flag = 1;
-        suitableBlock -> line = line;
-        suitableBlock -> filename = filename;
-        suitableBlock -> checksum = 0;
-        suitableBlock -> checksum = add_bytes(suitableBlock, sizeof(struct chunk_t));
+    if (done < count)
+    {
+        heap_free_batch(pointers, done);
+        return 0;
+    }
 
-        memcpy(((char *)suitableBlock) + sizeof(struct chunk_t), fence, sizeof(fence));
-        memcpy(((char *)suitableBlock) + sizeof(struct chunk_t) + sizeof(fence) + bytes, fence, sizeof(fence));
+    for (size_t i = 0; i < count; i++) sample_allocation(pointers[i], bytes, line, filename);
+    return count;
+}
 
-        myHeap.chunk_count = 1;        
-        myHeap.checksum = 0;
-        myHeap.checksum = add_bytes(&myHeap, sizeof(myHeap));
+void carve_blocks(struct arena_t * arena, struct chunk_t * chunk, size_t bytes, size_t count, void ** pointers, int line, const char * filename)
+{
+    //Cuts a block in use holding count payloads and their metadata into count blocks in use of bytes each
+    for (size_t i = 0; i < count; i++)
+    {
+        pointers[i] = (char *)chunk + move_to_data_block;
+        if (i + 1 == count) break;
+
+        split(arena, chunk, bytes);
+        struct chunk_t * next = chunk_next(chunk);
+        bin_remove(arena, next);
+        next -> taken_flag = 1;
+        size_index_add(&arena -> used_sizes, next -> size);
+        chunk_set_site(arena, next, line, filename);
+        profile_update(line, filename, next -> size, 1);
+        next -> checksum = 0;
+        next -> checksum = add_bytes(next, sizeof(struct chunk_t));
+        chunk = next;
+    }
+}
 
-        pthread_mutex_unlock(&myMutex);
-        return (((char *)suitableBlock) + move_to_data_block);
+struct heap_region_t * heap_region_create_debug(size_t initial_size, int line, const char * filename)
+{
+    struct heap_region_t * region = heap_malloc_debug(sizeof(struct heap_region_t), line, filename);
+    if (region == NULL) return NULL;
+
+    memset(region, 0, sizeof(struct heap_region_t));
+    region -> chunk_size = initial_size > REGION_MIN_CHUNK ? initial_size : REGION_MIN_CHUNK;
+    region -> line = line;
+    region -> filename = filename;
+    if (region_grow(region, 0) < 0)
+    {
+        heap_free(region);
+        return NULL;
+    }
+    return region;
+}
+
+int region_grow(struct heap_region_t * region, size_t bytes)
+{
+    //Starts a new chunk holding at least bytes, the rest of the current chunk is left unused
+    size_t size = region -> chunk_size;
+    if (bytes > CHUNK_MAX_SIZE - sizeof(struct heap_region_chunk_t)) return -1;
+    if (bytes + sizeof(struct heap_region_chunk_t) > size) size = bytes + sizeof(struct heap_region_chunk_t);
+
+    struct heap_region_chunk_t * chunk = heap_malloc_debug(size, region -> line, region -> filename);
+    if (chunk == NULL) return -1;
+
+    chunk -> next = region -> chunks;
+    chunk -> size = size;
+    region -> chunks = chunk;
+    region -> cursor = (char *)(chunk + 1);
+    region -> end = (char *)chunk + size;
+    if (region -> chunk_size < REGION_MAX_CHUNK) region -> chunk_size *= 2;
+    return 0;
+}
 
+void * heap_region_alloc(struct heap_region_t * region, size_t size, size_t alignment)
+{
+    //No header per allocation, the memory lives until the region is reset or destroyed
+    //Alignment 0 stands for the alignment of a pointer
+    if (region == NULL || size == 0) return NULL;
+    if (alignment == 0) alignment = sizeof(void *);
+    if (alignment & (alignment - 1))
+    {
+        heap_message("Passed alignment which is not a power of two to heap_region_alloc\n");
+        return NULL;
     }
-    else //Suitable block is a free block
+
+    uintptr_t start = ((uintptr_t)region -> cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (start < (uintptr_t)region -> cursor || start > (uintptr_t)region -> end || size > (uintptr_t)region -> end - start)
     {
-        suitableBlock -> size = bytes;
-        suitableBlock -> taken_flag = 1;
-        suitableBlock -> line = line;
-        suitableBlock -> filename = filename;
-        suitableBlock -> checksum = 0;
-        suitableBlock -> checksum = add_bytes(suitableBlock, sizeof(struct chunk_t));
+        if (size > SIZE_MAX - alignment || region_grow(region, size + alignment - 1) < 0) return NULL;
+        start = ((uintptr_t)region -> cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    }
 
-        //We now only need to modify the position of the right side fence
-        memcpy(((char *)suitableBlock) + suitableBlock->size + metadata_size - fence_size, fence, sizeof(fence));
+    region -> cursor = (char *)start + size;
+    return (void *)start;
+}
 
-        pthread_mutex_unlock(&myMutex);
-        return (((char *)suitableBlock) + move_to_data_block);
+void heap_region_reset(struct heap_region_t * region)
+{
+    //Keeps the newest chunk, which is the largest one unless a single allocation needed more
+    if (region == NULL) return;
+
+    region_release_chunks(region -> chunks -> next);
+    region -> chunks -> next = NULL;
+    region -> cursor = (char *)(region -> chunks + 1);
+}
+
+void heap_region_destroy(struct heap_region_t * region)
+{
+    if (region == NULL) return;
+
+    region_release_chunks(region -> chunks);
+    heap_free(region);
+}
+
+void region_release_chunks(struct heap_region_chunk_t * chunk)
+{
+    //Chunks go back to the heap a window at a time, so neighbouring chunks merge in one sweep
+    void * window[FREE_BATCH_WINDOW];
+    size_t count = 0;
+    while (chunk)
+    {
+        window[count++] = chunk;
+        chunk = chunk -> next;
+        if (count == FREE_BATCH_WINDOW || chunk == NULL)
+        {
+            heap_free_batch(window, count);
+            count = 0;
+        }
     }
 }
 
 void * heap_calloc_debug(size_t n, size_t size_of_element, int line, const char * filename)
 {
-    pthread_mutex_lock(&myMutex);
+    uint64_t start = latency_enter();
+    void * ptr = calloc_request(n, size_of_element, line, filename);
+    latency_leave(latency_calloc, start);
+    return ptr;
+}
+
+void * calloc_request(size_t n, size_t size_of_element, int line, const char * filename)
+{
     //Calloc code here with bonus information about blocks allocated or failures
-    if (heap_validate() < 0)
+    if (heap_check() < 0)
     {   
-        printf("Detected heap integrity breach\n");
-        printf("Calloc called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Detected heap integrity breach\n");
+        heap_message("Calloc called in line: %d\nAnd filename: %s\n", line, filename);
         return NULL;
     }
 
     if (n < 1) 
     {
-        printf("Calloc given n < 1 elements\n");
-        printf("Calloc called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Calloc given n < 1 elements\n");
+        heap_message("Calloc called in line: %d\nAnd filename: %s\n", line, filename);
         return NULL;
     }
 
     if (size_of_element < 1)
     {
-        printf("Calloc given size_of_element < 1\n");
-        printf("Calloc called in line:%d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Calloc given size_of_element < 1\n");
+        heap_message("Calloc called in line:%d\nAnd filename: %s\n", line, filename);
         return NULL;
     } 
 
-    pthread_mutex_unlock(&myMutex);
-    void * ret = heap_malloc(n * size_of_element);
-    pthread_mutex_lock(&myMutex);    
+    void * ret = heap_malloc_debug(n * size_of_element, line, filename);
     if (ret != NULL) memset(ret, 0, n * size_of_element);
-    pthread_mutex_unlock(&myMutex);
     return ret;
 }
 
 void * heap_realloc_debug(void * ptr, size_t new_size, int line, const char * filename)
 {
-    pthread_mutex_lock(&myMutex);
-    if (heap_validate() < 0)
+    uint64_t start = latency_enter();
+    void * res = realloc_request(ptr, new_size, line, filename);
+    latency_leave(latency_realloc, start);
+    return res;
+}
+
+void * realloc_request(void * ptr, size_t new_size, int line, const char * filename)
+{
+    if (heap_check() < 0)
     {
-        printf("Detected heap integrity breach\n");
-        printf("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Detected heap integrity breach\n");
+        heap_message("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
         return NULL;
     }
 
     if (new_size + sizeof(struct chunk_t) < new_size)
     {
-        pthread_mutex_unlock(&myMutex);
-        printf("Called realloc with negative bytes!\n");
-        printf("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
+        heap_message("Called realloc with negative bytes!\n");
+        heap_message("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
         return NULL;
     }
 
     if (!ptr) 
     {
-        printf("Called realloc with NULL pointer, executing heap_malloc\n");
-        printf("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
-        return heap_malloc(new_size);
+        heap_message("Called realloc with NULL pointer, executing heap_malloc\n");
+        heap_message("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
+        return heap_malloc_debug(new_size, line, filename);
     }
     
     if (!new_size) 
     {
-        printf("Called realloc with !new_size, executing heap_free\n");
-        printf("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Called realloc with !new_size, executing heap_free\n");
+        heap_message("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
         heap_free(ptr);
         return ptr;
     }
 
-    //Try to malloc a block with new_size
-    pthread_mutex_unlock(&myMutex);
-    void * res = heap_malloc(new_size);
-    //If sucessful copy over the contents of old block
-    if (res)
+    void * res = realloc_block(ptr, new_size, 0, line, filename);
+    if (res == NULL)
+    {
+        heap_message("Not enough space on the heap\n");
+        heap_message("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
+    }
+    return res;
+}
+
+void * realloc_block(void * ptr, size_t new_size, size_t alignment, int line, const char * filename)
+{
+    //Resizes the block where it is if the heap around it allows it
+    //A block which doesn't have the requested alignment yet always moves
+    struct arena_t * arena = arena_of(ptr);
+    int in_place = alignment == 0 || (uintptr_t)ptr % alignment == 0;
+    if (in_place && arena)
+    {
+        arena_lock(arena);
+        int resized = resize_block(arena, ptr, new_size);
+        pthread_mutex_unlock(&arena -> lock);
+        if (resized) return ptr;
+    }
+    else if (in_place)
     {
-        memcpy(res, ptr, new_size);
+        //Mapped blocks are remapped, the data keeps its offset from the page so it keeps its alignment as well
+        void * res = mapping_resize(ptr, new_size);
+        if (res)
+        {
+            sample_move(ptr, res);
+            return res;
+        }
     }
-    else 
+
+    size_t old_size = heap_get_block_size(ptr);
+    if (old_size == 0)
     {
-        printf("Not enough space on the heap\n");
-        printf("Realloc called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Invalid pointer passed to realloc\n");
         return NULL;
     }
 
-    //Free old block
-    pthread_mutex_unlock(&myMutex);
-    heap_free(ptr);
+    //Otherwise the contents move to a new block, only the bytes both blocks have are copied
+    void * res = alignment ? heap_memalign_debug(alignment, new_size, line, filename) : heap_malloc_debug(new_size, line, filename);
+    if (res == NULL) return NULL;
 
-    //Return the address of new block
+    memcpy(res, ptr, old_size < new_size ? old_size : new_size);
+    heap_free(ptr);
     return res;
 }
 
-void * heap_malloc_aligned_debug(size_t bytes, int line, const char * filename)
+int resize_block(struct arena_t * arena, void * ptr, size_t new_size)
 {
-    pthread_mutex_lock(&myMutex);
-    if (heap_validate < 0)
+    //Returns 1 when the block at ptr now holds new_size bytes without moving, the caller holds the arena lock
+    if (new_size > CHUNK_MAX_SIZE || arena_check(arena) < 0 || arena_pointer_type(arena, ptr) != pointer_valid) return 0;
+
+    struct chunk_t * chunk = page_map_find(arena, ptr);
+    if (chunk -> slab_flag) return new_size <= slab_of(chunk) -> object_size;
+    if (chunk_check(arena, chunk) < 0 || chunk_check(arena, chunk_next(chunk)) < 0) return 0;
+
+    //Growing takes the free right neighbour first
+    struct chunk_t * right = chunk_next(chunk);
+    if (new_size > chunk -> size && right && right -> taken_flag == 0 && (chunk -> size + metadata_size + right -> size >= new_size || chunk_next(right) == NULL))
     {
-        printf("Heap_malloc_aligned_debug detected a breach in heap's integrity\n");
-        printf("Function called in line: %d in filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
-        return NULL;
+        coalesce_blocks(arena, chunk);
     }
 
-    if (bytes < 1)
+    //The last block can grow past the end of the heap
+    if (new_size > chunk -> size && chunk_next(chunk) == NULL)
     {
-        printf("Passed non positive amount of bytes to Heap_malloc_aligned_debug\n");
-        printf("Function called in line: %d in filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
-        return NULL;
+        size_t grow = page_size(new_size - chunk -> size);
+        uint64_t start = latency_start();
+        void * res = arena_sbrk(arena, grow);
+        latency_record(latency_grow, start);
+        if (res == ((void *)-1)) return 0;
+
+        arena -> heap.max_heap_size += grow;
+        arena -> heap.checksum = 0;
+        arena -> heap.checksum = add_bytes(&arena -> heap, sizeof(heap));
+
+        size_index_remove(&arena -> used_sizes, chunk -> size);
+        profile_chunk(arena, chunk, grow, 0);
+        chunk -> size += grow;
+        size_index_add(&arena -> used_sizes, chunk -> size);
+        chunk -> checksum = 0;
+        chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
+        for (int i = 0; i < fence_size; i++)
+        {
+            *((char *)chunk + move_to_data_block + chunk -> size + i) = i;
+        }
     }
 
-    //Look for free blocks that lie on the edges of page and check if...
-    //They can be splitted to host our new block.
+    if (new_size > chunk -> size) return 0;
 
-    //For iterating over the heap
-    char * temp = (char *)myHeap.heap;
+    //Tail which can hold a block of its own goes back to the heap
+    if (chunk -> size >= new_size + metadata_size)
+    {
+        split(arena, chunk, new_size);
+        struct chunk_t * tail = chunk_next(chunk);
+        if (chunk_next(tail) && chunk_next(tail) -> taken_flag == 0) coalesce_blocks(arena, tail);
+    }
+    return 1;
+}
 
-    int steps = myHeap.max_heap_size / PAGE_SIZE - 1;
-    if (steps <= 0) 
+void * arena_memalign(struct arena_t * arena, size_t alignment, size_t bytes, int line, const char * filename)
+{
+    //Over-allocates by the alignment and gives back what lies in front of and behind the aligned block
+    //Both leftovers can hold the metadata of a free block so the aligned block gets the exact size
+    char * ptr = allocate_block(arena, bytes + alignment + metadata_size * 2, line, filename);
+    if (ptr == NULL) return NULL;
+
+    struct chunk_t * chunk = (struct chunk_t *)(ptr - move_to_data_block);
+    size_t gap = (alignment - (uintptr_t)ptr % alignment) % alignment;
+    if (gap)
     {
-        pthread_mutex_unlock(&myMutex); 
-        return NULL;
+        //Space in front has to hold the metadata of a free block
+        if (gap < metadata_size) gap += (metadata_size - gap + alignment - 1) / alignment * alignment;
+
+        split(arena, chunk, gap - metadata_size);
+        struct chunk_t * aligned = chunk_next(chunk);
+        bin_remove(arena, aligned);
+        aligned -> taken_flag = 1;
+        size_index_add(&arena -> used_sizes, aligned -> size);
+        chunk_set_site(arena, aligned, line, filename);
+        aligned -> checksum = 0;
+        aligned -> checksum = add_bytes(aligned, sizeof(struct chunk_t));
+
+        //Profile sees a single block which got smaller, not the leading gap being freed
+        profile_update(line, filename, (int64_t)aligned -> size - (int64_t)chunk -> size, 0);
+        chunk_clear_site(arena, chunk);
+        size_index_remove(&arena -> used_sizes, chunk -> size);
+        chunk -> taken_flag = 0;
+        chunk -> checksum = 0;
+        chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
+        bin_insert(arena, chunk);
+
+        struct chunk_t * left = chunk_prev(chunk);
+        if (left && left -> taken_flag == 0) coalesce_blocks(arena, left);
+        chunk = aligned;
     }
-    temp += PAGE_SIZE;
 
-    for (int i = 0; i < steps; i++)
+    //Tail which can hold a block of its own goes back to the heap
+    if (chunk -> size >= bytes + metadata_size)
     {
-        //Checks if we landed in user data and free block
-        if (get_pointer_type((void *)temp) == pointer_inside_data_block)
-        {
-            struct chunk_t * chunk = heap_get_data_block_start(temp);
-            if (chunk -> taken_flag == 0)
-            {
-                //Check if we have to do any splitting
-                //If not just return this pointer because the block is perfect
-                if (chunk -> size == bytes && (((char *)chunk + move_to_data_block) == temp)) 
-                {
-                    pthread_mutex_unlock(&myMutex);
-                    return (void *)((char *)chunk + move_to_data_block);
-                }
-                
-                // Blocks fits but payload is too large and can be splitted
-                if (chunk -> size > (bytes + metadata_size) && (((char *)chunk + move_to_data_block) == temp))
-                {
-                    split(chunk, bytes);
-                    pthread_mutex_unlock(&myMutex);
-                    return (void *)((char *)chunk + move_to_data_block);
-                }
-                
-                //Block doesnt fit perfectly, test to see if we can use it
-                if ((((char *)chunk + move_to_data_block) != temp))
-                {
-                    //Get chunks distance from the page end to see if we can fit metadata_size in there
-                    int distance_left = (temp - ((char *)chunk + (sizeof(struct chunk_t) + fence_size)));
-                    int distance_right = ((char *)chunk + move_to_data_block + chunk -> size) - temp;
-
-                    //This block can be used but we have to check if there can occur a third split
-                    if (distance_left > metadata_size && distance_right > (bytes + fence_size + metadata_size)) 
-                    {
-                        //This means we can split the original block into three blocks
-                        split(chunk, distance_left - metadata_size);
-
-                        chunk = chunk -> next;
-                        split(chunk, bytes);
-                        chunk -> taken_flag = 1;
-                        chunk -> line = line;
-                        chunk -> filename = filename;
-                        chunk -> checksum = 0;
-                        chunk -> checksum = add_bytes(chunk, sizeof(struct chunk_t));
-
-                        pthread_mutex_unlock(&myMutex);
-                        return (void *)((char *)chunk + move_to_data_block);
-                    }
-                }                
-            }
-        }
+        split(arena, chunk, bytes);
+        struct chunk_t * tail = chunk_next(chunk);
+        if (chunk_next(tail) && chunk_next(tail) -> taken_flag == 0) coalesce_blocks(arena, tail);
+    }
 
+    return (char *)chunk + move_to_data_block;
+}
+
+void * heap_memalign_debug(size_t alignment, size_t bytes, int line, const char * filename)
+{
+    uint64_t start = latency_enter();
+    void * ptr = memalign_request(alignment, bytes, line, filename);
+    latency_leave(latency_memalign, start);
+    sample_allocation(ptr, bytes, line, filename);
+    return ptr;
+}
 
-        temp += PAGE_SIZE;
+void * memalign_request(size_t alignment, size_t bytes, int line, const char * filename)
+{
+    if (heap_check() < 0)
+    {
+        heap_message("Heap_memalign_debug detected a breach in heap's integrity\n");
+        heap_message("Function called in line: %d in filename: %s\n", line, filename);
+        return NULL;
     }
 
-    pthread_mutex_unlock(&myMutex);
-    return NULL;
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        heap_message("Passed alignment which is not a power of two to Heap_memalign_debug\n");
+        heap_message("Function called in line: %d in filename: %s\n", line, filename);
+        return NULL;
+    }
+
+    if (bytes < 1 || bytes > CHUNK_MAX_SIZE || alignment > CHUNK_MAX_SIZE - bytes - metadata_size * 2)
+    {
+        heap_message("Passed wrong amount of bytes to Heap_memalign_debug\n");
+        heap_message("Function called in line: %d in filename: %s\n", line, filename);
+        return NULL;
+    }
+
+    struct arena_t * arena = lock_thread_arena();
+    if (arena == NULL) return NULL;
+
+    void * ptr = arena_memalign(arena, alignment, bytes, line, filename);
+    pthread_mutex_unlock(&arena -> lock);
+    return ptr;
 }
 
-void * heap_calloc_aligned_debug(size_t n, size_t size_of_element, int line, const char * filename)
+void * heap_calloc_memalign_debug(size_t alignment, size_t n, size_t size_of_element, int line, const char * filename)
 {
     //Calloc code here with bonus information about blocks allocated or failures
-    pthread_mutex_lock(&myMutex);
-    if (heap_validate() < 0)
-    {   
-        printf("Detected heap integrity breach\n");
-        printf("Calloc_aligned called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
-        return NULL;
-    }
     if (n < 1) 
     {
-        printf("Calloc_aligned given n < 1 elements\n");
-        printf("Calloc_aligned called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Calloc_memalign given n < 1 elements\n");
+        heap_message("Calloc_memalign called in line: %d\nAnd filename: %s\n", line, filename);
         return NULL;
     }
     if (size_of_element < 1)
     {
-        printf("Calloc_aligned given size_of_element < 1\n");
-        printf("Calloc_aligned called in line:%d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Calloc_memalign given size_of_element < 1\n");
+        heap_message("Calloc_memalign called in line:%d\nAnd filename: %s\n", line, filename);
         return NULL;
     } 
+    if (n > SIZE_MAX / size_of_element)
+    {
+        heap_message("Detected overflow in calloc_memalign\n");
+        heap_message("Calloc_memalign called in line: %d\nAnd filename: %s\n", line, filename);
+        return NULL;
+    }
 
-    pthread_mutex_unlock(&myMutex);
-    void * ret = heap_malloc_aligned(n * size_of_element);
-    pthread_mutex_lock(&myMutex);
+    void * ret = heap_memalign_debug(alignment, n * size_of_element, line, filename);
     if (ret != NULL) memset(ret, 0, n * size_of_element);
-    pthread_mutex_unlock(&myMutex);
     return ret;
 }
 
-void * heap_realloc_aligned_debug(void * ptr, size_t new_size, int line, const char * filename)
+void * heap_realloc_memalign_debug(size_t alignment, void * ptr, size_t new_size, int line, const char * filename)
 {
-    if (heap_validate() < 0)
+    if (heap_check() < 0)
     {
-        printf("Detected heap integrity breach\n");
-        printf("Realloc_aligned called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Detected heap integrity breach\n");
+        heap_message("Realloc_memalign called in line: %d\nAnd filename: %s\n", line, filename);
         return NULL;
     }
     
     if (new_size + sizeof(struct chunk_t) < new_size) 
     {
-        printf("Detected overflow in realloc_aligned\n");
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Detected overflow in realloc_memalign\n");
+        return NULL;
+    }
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        heap_message("Passed alignment which is not a power of two to realloc_memalign\n");
+        heap_message("Realloc_memalign called in line: %d\nAnd filename: %s\n", line, filename);
         return NULL;
     }
 
     if (!ptr) 
     {
-        printf("NULL passed to realloc_aligned, executing malloc_aligned\n");
-        pthread_mutex_unlock(&myMutex);
-        return heap_malloc_aligned(new_size);
+        heap_message("NULL passed to realloc_memalign, executing memalign\n");
+        return heap_memalign_debug(alignment, new_size, line, filename);
     }
 
     if (!new_size) 
     {
-        printf("Realloc_aligned given size 0, executing heap_free\n");
-        pthread_mutex_unlock(&myMutex);
+        heap_message("Realloc_memalign given size 0, executing heap_free\n");
         heap_free(ptr);
         return ptr;
     }
 
-    //Try to malloc a block with new_size
-    pthread_mutex_unlock(&myMutex);
-    void * res = heap_malloc_aligned(new_size);
-    pthread_mutex_lock(&myMutex);
-
-    //If sucessful copy over the contents of old block
-    if (res)
+    void * res = realloc_block(ptr, new_size, alignment, line, filename);
+    if (res == NULL)
     {
-        memcpy(res, ptr, heap_get_block_size(res));
+        heap_message("Not enough space on the heap\n");
+        heap_message("Realloc_memalign called in line: %d\nAnd filename: %s\n", line, filename);
     }
-    else 
-    {
-        printf("Not enough space on the heap\n");
-        printf("Realloc_aligned called in line: %d\nAnd filename: %s\n", line, filename);
-        pthread_mutex_unlock(&myMutex);
-        return NULL;
-    }
-    
-    //Free old block
-    pthread_mutex_unlock(&myMutex);
-    heap_free(ptr);
-
-    //Return the address of new block
     return res;
 }
 
+void * heap_malloc_aligned_debug(size_t bytes, int line, const char * filename)
+{
+    return heap_memalign_debug(PAGE_SIZE, bytes, line, filename);
+}
+
+void * heap_calloc_aligned_debug(size_t n, size_t size_of_element, int line, const char * filename)
+{
+    return heap_calloc_memalign_debug(PAGE_SIZE, n, size_of_element, line, filename);
+}
+
+void * heap_realloc_aligned_debug(void * ptr, size_t new_size, int line, const char * filename)
+{
+    return heap_realloc_memalign_debug(PAGE_SIZE, ptr, new_size, line, filename);
+}
+
 void * heap_get_data_block_start(const void * pointer)
 {
-    if (heap_validate() < 0)
+    if (heap_check() < 0)
     {
-        printf("Detected heap integrity breach during heap_get_data_block_start\n");
+        heap_message("Detected heap integrity breach during heap_get_data_block_start\n");
         return NULL;
     }
 
     if (pointer == NULL) return NULL;
 
-    enum pointer_type_t pointer_validation = get_pointer_type(pointer);
+    struct arena_t * arena = arena_of(pointer);
+    if (arena == NULL) return mapping_data_block_start(pointer);
+
+    arena_lock(arena);
+    void * res = arena_data_block_start(arena, pointer);
+    pthread_mutex_unlock(&arena -> lock);
+    return res;
+}
+
+void * arena_data_block_start(struct arena_t * arena, const void * pointer)
+{
+    enum pointer_type_t pointer_validation = arena_pointer_type(arena, pointer);
 
     if (pointer_validation != pointer_valid && pointer_validation != pointer_inside_data_block) return NULL;
 
-    struct chunk_t * temp = myHeap.first_chunk;
-    while (temp)
-    {
-        char * temp_data = ((char *)temp) + sizeof(struct chunk_t) + fence_size;
-        if ((char *)pointer >= temp_data && (char *)pointer <= temp_data + temp -> size) return temp;
-        temp = temp -> next;
-    }
+    return page_map_find(arena, pointer);
+}
 
-    return NULL;
+void arena_get_stats(struct arena_t * arena, struct heap_arena_stats_t * stats)
+{
+    //Reads the counters kept by every operation, the caller holds the arena lock
+    memset(stats, 0, sizeof(struct heap_arena_stats_t));
+    stats -> contention = __atomic_load_n(&arena -> contention, __ATOMIC_RELAXED);
+    stats -> threads = arena -> threads;
+    if (arena -> heap.heap == NULL) return;
+
+    stats -> heap_size = arena -> heap.max_heap_size;
+    stats -> free_space = arena -> free_sizes.bytes + arena -> slab_free_space;
+    stats -> used_space = stats -> heap_size - stats -> free_space;
+    stats -> used_blocks_count = arena -> used_sizes.count;
+    stats -> free_gaps_count = arena -> free_gaps_count;
+    stats -> largest_used_block_size = size_index_max(&arena -> used_sizes);
+    stats -> largest_free_area = size_index_max(&arena -> free_sizes);
 }
 
-size_t heap_get_used_space(void)
+void arena_count_stats(struct arena_t * arena, struct heap_arena_stats_t * stats)
 {
-    if (heap_validate() < 0)
+    //Walks the arena and counts what the counters should hold, used to check them
+    memset(stats, 0, sizeof(struct heap_arena_stats_t));
+    stats -> contention = __atomic_load_n(&arena -> contention, __ATOMIC_RELAXED);
+    stats -> threads = arena -> threads;
+    if (arena -> heap.heap == NULL) return;
+
+    for (struct chunk_t * temp = arena -> heap.first_chunk; temp; temp = chunk_next(temp))
     {
-        printf("Detected heap integrity breach during heap_get_used_space\n");
-        return 0;
+        chunk_count_stats(temp, stats);
     }
-    return (myHeap.max_heap_size - heap_get_free_space());
+    stats -> heap_size = arena -> heap.max_heap_size;
+    stats -> used_space = stats -> heap_size - stats -> free_space;
 }
 
-size_t heap_get_largest_used_block_size(void)
+void chunk_count_stats(struct chunk_t * chunk, struct heap_arena_stats_t * stats)
 {
-    if (heap_validate() < 0)
+    if (chunk -> taken_flag && chunk -> slab_flag)
     {
-        printf("Detected heap integrity breach during heap_get_largest_used_block_size\n");
-        return 0;
+        //Objects of a slab count as blocks, their free slots as free space
+        struct slab_t * slab = slab_of(chunk);
+        stats -> used_blocks_count += slab -> capacity - slab -> free_count;
+        stats -> free_space += (size_t)slab -> free_count * slab -> object_size;
+        if (slab -> free_count < slab -> capacity && slab -> object_size > stats -> largest_used_block_size) stats -> largest_used_block_size = slab -> object_size;
+    }
+    else if (chunk -> taken_flag)
+    {
+        stats -> used_blocks_count++;
+        if (chunk -> size > stats -> largest_used_block_size) stats -> largest_used_block_size = chunk -> size;
+    }
+    else
+    {
+        stats -> free_space += chunk -> size;
+        if (chunk -> size > stats -> largest_free_area) stats -> largest_free_area = chunk -> size;
+        if (chunk -> size >= FREE_GAP_MIN_SIZE) stats -> free_gaps_count++;
     }
+}
 
-    struct chunk_t * temp = myHeap.first_chunk;
+int heap_collect_stats(struct heap_arena_stats_t * total)
+{
+    //Sums the statistics of every arena in use, largest blocks are the largest of all arenas
+    //Only counters are read so the heap isn't validated here
 
-    int largest_found_size = temp -> size;
-    while (temp)
+    memset(total, 0, sizeof(struct heap_arena_stats_t));
+    for (int i = 0; i < HEAP_MAX_ARENAS; i++)
     {
-        if (temp -> next == NULL) break;
-        if (temp -> size > largest_found_size)
-        {
-            largest_found_size = temp -> size;
-        }
-        temp = temp -> next;
+        struct arena_t * arena = &arenas[i];
+        if (arena -> heap.heap == NULL) continue;
+
+        struct heap_arena_stats_t stats;
+        arena_lock(arena);
+        arena_get_stats(arena, &stats);
+        pthread_mutex_unlock(&arena -> lock);
+
+        total -> heap_size += stats.heap_size;
+        total -> used_space += stats.used_space;
+        total -> free_space += stats.free_space;
+        total -> used_blocks_count += stats.used_blocks_count;
+        total -> free_gaps_count += stats.free_gaps_count;
+        total -> contention += stats.contention;
+        total -> threads += stats.threads;
+        if (stats.largest_used_block_size > total -> largest_used_block_size) total -> largest_used_block_size = stats.largest_used_block_size;
+        if (stats.largest_free_area > total -> largest_free_area) total -> largest_free_area = stats.largest_free_area;
     }
+    mappings_get_stats(total);
+    return 0;
+}
+
+int heap_get_arena_stats(int index, struct heap_arena_stats_t * stats)
+{
+    if (index < 0 || index >= HEAP_MAX_ARENAS || stats == NULL) return -1;
 
-    return largest_found_size;    
+    struct arena_t * arena = &arenas[index];
+    arena_lock(arena);
+    arena_get_stats(arena, stats);
+    pthread_mutex_unlock(&arena -> lock);
+    return 0;
 }
 
-size_t heap_get_free_space(void)
+size_t heap_get_used_space(void)
 {
-    if (heap_validate() < 0)
+    struct heap_arena_stats_t stats;
+    if (heap_collect_stats(&stats) < 0)
     {
-        printf("Detected heap integrity breach during heap_get_free_space\n");
+        heap_message("Detected heap integrity breach during heap_get_used_space\n");
         return 0;
     }
+    return stats.used_space;
+}
 
-    struct chunk_t * temp = myHeap.first_chunk;
-
-    size_t size = 0;
-    while (temp)
+size_t heap_get_largest_used_block_size(void)
+{
+    struct heap_arena_stats_t stats;
+    if (heap_collect_stats(&stats) < 0)
     {
-        if (temp -> taken_flag == 0) size += temp -> size;
-        temp = temp -> next;
+        heap_message("Detected heap integrity breach during heap_get_largest_used_block_size\n");
+        return 0;
     }
-    return size;
+    return stats.largest_used_block_size;
 }
 
-size_t heap_get_largest_free_area(void)
+size_t heap_get_free_space(void)
 {
-    if (heap_validate() < 0)
+    struct heap_arena_stats_t stats;
+    if (heap_collect_stats(&stats) < 0)
     {
-        printf("Detected heap integrity breach during heap_get_largest_free_area\n");
+        heap_message("Detected heap integrity breach during heap_get_free_space\n");
         return 0;
     }
+    return stats.free_space;
+}
 
-    struct chunk_t * temp = myHeap.first_chunk;
-    int current_largest_free_area = 0;
-    while (temp)
+size_t heap_get_largest_free_area(void)
+{
+    struct heap_arena_stats_t stats;
+    if (heap_collect_stats(&stats) < 0)
     {
-        if (temp -> size > current_largest_free_area && temp ->taken_flag == 0) current_largest_free_area = temp -> size;
-        temp = temp -> next;
+        heap_message("Detected heap integrity breach during heap_get_largest_free_area\n");
+        return 0;
     }
-
-    return current_largest_free_area;
+    return stats.largest_free_area;
 }
 
 size_t heap_get_block_size(const const void * memblock)
 {
-    if (heap_validate() < 0)
+    if (heap_check() < 0)
     {
-        printf("Detected heap integrity breach during heap_get_block_size\n");
+        heap_message("Detected heap integrity breach during heap_get_block_size\n");
         return 0;
     }
 
-    if (get_pointer_type(memblock) != pointer_valid) return 0;
-    struct chunk_t * temp = (struct chunk_t *)((char *)memblock - move_to_data_block);
-    size_t size = temp -> size;
+    if (memblock == NULL) return 0;
 
+    struct arena_t * arena = arena_of(memblock);
+    if (arena == NULL)
+    {
+        if (mapping_pointer_type(memblock) != pointer_valid) return 0;
+        return ((struct chunk_t *)((char *)memblock - move_to_data_block)) -> size;
+    }
+
+    arena_lock(arena);
+    size_t size = arena_block_size(arena, memblock);
+    pthread_mutex_unlock(&arena -> lock);
     return size;
 }
 
+size_t arena_block_size(struct arena_t * arena, const void * pointer)
+{
+    //Payload of a block in use, objects of a slab report the size of their class
+    if (arena_pointer_type(arena, pointer) != pointer_valid) return 0;
+
+    struct chunk_t * temp = page_map_find(arena, pointer);
+    if (temp -> slab_flag) return slab_of(temp) -> object_size;
+    return temp -> size;
+}
+
 uint64_t heap_get_used_blocks_count(void)
 {
-    if (heap_validate() < 0)
+    struct heap_arena_stats_t stats;
+    if (heap_collect_stats(&stats) < 0)
     {
-        printf("Detected heap integrity breach during heap_get_used_blocks_count\n");
+        heap_message("Detected heap integrity breach during heap_get_used_blocks_count\n");
         return 0;
     }
-
-    struct chunk_t * temp = myHeap.first_chunk;
-    uint64_t used_blocks = 0;
-    while (temp)
-    {
-        if (temp -> taken_flag) used_blocks++;
-        temp = temp -> next;
-    }
-
-    return used_blocks;
+    return stats.used_blocks_count;
 }
 
 uint64_t heap_get_free_gaps_count(void)
 {
-    if (heap_validate() < 0)
+    struct heap_arena_stats_t stats;
+    if (heap_collect_stats(&stats) < 0)
     {
-        printf("Detected heap integrity breach during heap_get_free_gaps_count\n");
+        heap_message("Detected heap integrity breach during heap_get_free_gaps_count\n");
         return 0;
     }
-
-    struct chunk_t * temp = myHeap.first_chunk;
-    uint64_t free_blocks = 0;
-    size_t machine_word_size = 72;
-    while (temp)
-    {
-        if (!(temp -> taken_flag) && temp -> size >= 72) free_blocks++;
-        temp = temp -> next;
-    }
-
-    return free_blocks;
+    return stats.free_gaps_count;
 }
 
 enum pointer_type_t get_pointer_type(const const void * pointer)
 {
-    if (heap_validate() < 0)
+    if (heap_check() < 0)
     {
-        printf("Detected heap integrity breach during get_pointer_type\n");
+        heap_message("Detected heap integrity breach during get_pointer_type\n");
         return pointer_null;
     }
 
     if (!pointer) return pointer_null;
 
+    //Pointers outside of every arena and mapping are out of heap
+    struct arena_t * arena = arena_of(pointer);
+    if (arena == NULL) return mapping_pointer_type(pointer);
+
+    arena_lock(arena);
+    enum pointer_type_t res = arena_pointer_type(arena, pointer);
+    pthread_mutex_unlock(&arena -> lock);
+    return res;
+}
+
+enum pointer_type_t arena_pointer_type(struct arena_t * arena, const void * pointer)
+{
+    if (!pointer) return pointer_null;
+
     //Validate pointer out of heap
-    if (pointer < myHeap.heap || pointer > (void *)(((char *)myHeap.heap) + myHeap.max_heap_size))
+    if (pointer < arena -> heap.heap || pointer > (void *)(((char *)arena -> heap.heap) + arena -> heap.max_heap_size))
     {
         return pointer_out_of_heap;
     }
 
+    //The page map gives the only chunk which can hold the pointer
+    struct chunk_t * temp = page_map_find(arena, pointer);
+    if (temp == NULL) return pointer_null;
+
+    if (temp -> slab_flag && (char *)pointer >= (char *)temp + move_to_data_block && (char *)pointer < (char *)temp + move_to_data_block + temp -> size)
+    {
+        return slab_pointer_type(temp, pointer);
+    }
+
     //Validate pointer_valid and unallocated
-    struct chunk_t * temp = myHeap.first_chunk;
-    while (temp)
+    if (pointer == (void *)(((char *)temp) + move_to_data_block))
     {
-        if (pointer == (void *)(((char *)temp) + move_to_data_block))
-        {
-            return temp -> taken_flag ? pointer_valid : pointer_unallocated;
-        }
-        temp = temp -> next;
+        return temp -> taken_flag == 1 ? pointer_valid : pointer_unallocated;
     }
 
     //Validate pointer inside data block
-    temp = myHeap.first_chunk;
-    while (temp)
+    if (((char *)pointer >= (((char *)temp) + move_to_data_block)) && ((char *)pointer <= (((char *)temp) + move_to_data_block + temp -> size)))
     {
-        if (((char *)pointer >= (((char *)temp) + move_to_data_block)) && ((char *)pointer <= (((char *)temp) + move_to_data_block + temp -> size)))
-        {
-            return pointer_inside_data_block; 
-        }
-        temp = temp -> next;
+        return pointer_inside_data_block; 
     }
 
     //Validate pointer control block
-    temp = myHeap.first_chunk;
-    while (temp)
-    {
-        if (((char *)pointer >= ((char *)temp)) && (char *)pointer < (((char *)temp) + move_to_data_block)) return pointer_control_block;
-        temp = temp -> next;
-    }
+    if (((char *)pointer >= ((char *)temp)) && (char *)pointer < (((char *)temp) + move_to_data_block)) return pointer_control_block;
 
     return pointer_null;
-}
\ No newline at end of file
+}
@@ -1,26 +1,112 @@
 #ifndef _MALOC_H_
 #define _MALOC_H_
 
+#ifdef HEAP_PRELOAD
+//Built as the malloc of a process, the first arena grows the real program break
+#include <unistd.h>
+#define custom_sbrk sbrk
+#else
 #include "custom_unistd.h"
+#endif
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "heap_snapshot.h"
 
 #define PAGE_SIZE 4096
+#ifdef HEAP_PRELOAD
+#define fence_size 16 //Size of fence in bytes, with sizes rounded to 16 bytes it keeps every payload 16 byte aligned
+#else
 #define fence_size 8 //Size of fence in bytes
+#endif
 #define metadata_size (sizeof(struct chunk_t) + fence_size * 2)
 #define move_to_data_block (sizeof(struct chunk_t) + fence_size)
 #define next_block(last_block) (((char *)last_block) + metadata_size + last_block -> size)
-#define prev_block(block) (((char *)block) - (metadata_size + block -> prev -> size))
+#define CHUNK_MAX_SIZE ((size_t)UINT32_MAX - 2 * PAGE_SIZE) //Largest payload, sizes are passed around as uint32_t
+#define BIN_COUNT 64 //Number of segregated free lists, must fit in the bitmap word
+#define TCACHE_MAX_SIZE 256 //Largest payload kept in the thread caches
+#define TCACHE_CLASS_COUNT (TCACHE_MAX_SIZE / 8)
+#define TCACHE_SLOTS 16 //Blocks cached per size class
+#define TCACHE_BATCH 8 //Blocks moved between a thread cache and the heap at once
+#define CHUNK_CACHED 2 //Taken flag of a block waiting in a thread cache, a second free of it is reported
+#define REGION_MIN_CHUNK 4096 //First chunk of a region is at least this large
+#define REGION_MAX_CHUNK (1024 * 1024) //Chunks stop doubling here, larger allocations get a chunk of their own size
+#define FREE_BATCH_WINDOW 256 //Pointers heap_free_batch sorts and releases at once
+#define REMOTE_FREE_SLOTS FREE_BATCH_WINDOW //Blocks other threads can queue for an arena, drained as one window
+#define REMOTE_FREE_PROBES 8 //Slots a queued block tries before it takes the lock instead
+#define HEAP_MAX_ARENAS 8 //Upper bound for heap_set_arena_count
+#define ARENA_RESERVE_SIZE ((size_t)256 * 1024 * 1024) //Address space reserved by every arena except the first
+#define PAGE_MAP_LEAF_BITS 12 //Pages covered by one leaf of the page map
+#define PAGE_MAP_ROOT_SIZE 4096 //Leaves in the page map, together they cover 64GB of an arena
+#define VALIDATION_DEFAULT_PERIOD 1024 //Operations between two full walks in the sampled mode
+#define SLAB_MAX_SIZE 256 //Largest object served by the slabs
+#define SLAB_CLASS_COUNT (SLAB_MAX_SIZE / 16) //Object sizes are multiples of 16 bytes
+#define SLAB_PAYLOAD (PAGE_SIZE - metadata_size) //Payload of a slab chunk, the whole chunk fills one page
+#define SLAB_MAP_WORDS 4 //Enough bits for the 16 byte class
+#define SITE_TABLE_MIN_CAPACITY 1024
+#define TRIM_DEFAULT_THRESHOLD (128 * 1024) //Free bytes at the end of an arena which make heap_free trim it
+#define HEAP_MAX_MAPPINGS 1024 //Blocks served by their own mapping at once, larger ones go to the heap past that
+#define SIZE_INDEX_MIN_CAPACITY 256
+#define FREE_GAP_MIN_SIZE 72 //Smaller free blocks don't count as gaps
+#define PROFILE_MIN_CAPACITY 256
+#define SAMPLE_DEFAULT_INTERVAL (512 * 1024) //Mean bytes between two samples suggested for HEAP_SAMPLE_INTERVAL
+#define SAMPLE_MAX_FRAMES 32 //Return addresses kept by every sample
+#define SAMPLE_MIN_CAPACITY 256
+#define SAMPLE_FILTER_SIZE 4096 //Counters of the filter checked by heap_free, a power of two
+#define LATENCY_BUCKET_COUNT 64 //Power of two buckets of the latency histograms
 
 
 #define heap_malloc(bytes) heap_malloc_debug(bytes, __LINE__, __FILE__)
 #define heap_calloc(n, size_of_element) heap_calloc_debug(n, size_of_element, __LINE__, __FILE__)
 #define heap_realloc(ptr, new_size) heap_realloc_debug(ptr, new_size, __LINE__, __FILE__)
+#define heap_region_create(initial_size) heap_region_create_debug(initial_size, __LINE__, __FILE__)
+#define heap_malloc_batch(bytes, count, pointers) heap_malloc_batch_debug(bytes, count, pointers, __LINE__, __FILE__)
 #define heap_malloc_aligned(bytes) heap_malloc_aligned_debug(bytes, __LINE__, __FILE__)
 #define heap_calloc_aligned(n, size_of_element) heap_calloc_aligned_debug(n, size_of_element, __LINE__, __FILE__)
 #define heap_realloc_aligned(ptr, new_size) heap_realloc_aligned_debug(ptr, new_size, __LINE__, __FILE__)
+#define heap_memalign(alignment, bytes) heap_memalign_debug(alignment, bytes, __LINE__, __FILE__)
+#define heap_calloc_memalign(alignment, n, size_of_element) heap_calloc_memalign_debug(alignment, n, size_of_element, __LINE__, __FILE__)
+#define heap_realloc_memalign(alignment, ptr, new_size) heap_realloc_memalign_debug(alignment, ptr, new_size, __LINE__, __FILE__)
+
+
+
+enum validation_mode_t
+{
+    validation_off, //No checks at all
+    validation_sampled, //Full walk of the heap every n-th operation
+    validation_local, //Only the chunks an operation touches are checked
+    validation_full //Full walk of the heap on every operation
+};
+
+enum placement_policy_t
+{
+    placement_good_fit, //Segregated bins, the first block that fits in the smallest bin that may hold one
+    placement_first_fit, //Block with the lowest address
+    placement_next_fit, //First block at or after the last placed block
+    placement_best_fit //Smallest block
+};
 
+enum profile_format_t
+{
+    profile_text, //Table sorted by live bytes
+    profile_pprof //Legacy heap profile with a symbol section
+};
 
+enum latency_kind_t
+{
+    latency_malloc, //Public functions, measured from call to return
+    latency_calloc,
+    latency_realloc,
+    latency_free,
+    latency_memalign,
+    latency_lock_wait, //Phases inside them
+    latency_search,
+    latency_grow,
+    latency_split,
+    latency_validate,
+    LATENCY_KIND_COUNT
+};
 
 enum pointer_type_t
 {
@@ -32,15 +118,207 @@ enum pointer_type_t
     pointer_valid
 };
 
+#ifdef HEAP_COMPACT_HEADER
+//16 byte boundary tag, neighbours are found from the sizes
+//Links of the free lists live in the payload of free blocks and the debug information in the site table
+struct chunk_t
+{
+    uint32_t size;
+    uint32_t prev_size; //Payload of the previous chunk
+    int checksum;
+    uint8_t taken_flag; //1 - in use | 0 - empty | 2 - freed into a thread cache
+    uint8_t slab_flag; //1 - payload is a slab of small objects
+    uint8_t first_flag; //1 - chunk starts the heap
+    uint8_t last_flag; //1 - chunk ends the heap
+};
+
+#define chunk_next(chunk) ((chunk) -> last_flag ? NULL : (struct chunk_t *)next_block(chunk))
+#define chunk_prev(chunk) ((chunk) -> first_flag ? NULL : (struct chunk_t *)((char *)(chunk) - metadata_size - (chunk) -> prev_size))
+#define chunk_set_next(chunk, next_chunk) ((chunk) -> last_flag = (next_chunk) == NULL)
+#define chunk_set_prev(chunk, prev_chunk) ((chunk) -> first_flag = (prev_chunk) == NULL, (chunk) -> prev_size = (prev_chunk) ? ((struct chunk_t *)(prev_chunk)) -> size : 0)
+#define chunk_next_free(chunk) (*(struct chunk_t **)((char *)(chunk) + move_to_data_block))
+#define chunk_prev_free(chunk) (*(struct chunk_t **)((char *)(chunk) + move_to_data_block + sizeof(struct chunk_t *)))
+#define chunk_binnable(chunk) ((chunk) -> size >= 2 * sizeof(struct chunk_t *)) //Payload has to hold both links
+#define chunk_init_site(chunk) ((void)0)
+#define chunk_set_site(arena, chunk, site_line, site_filename) site_table_set(arena, chunk, site_line, site_filename)
+#define chunk_clear_site(arena, chunk) site_table_remove(arena, chunk)
+#define chunk_line(arena, chunk) site_line(arena, chunk)
+#define chunk_filename(arena, chunk) site_filename(arena, chunk)
+#else
 struct chunk_t
 {
     struct chunk_t * next;
     struct chunk_t * prev;
     size_t size;
-    int taken_flag; //1 - in use | 0 - empty
+    int taken_flag; //1 - in use | 0 - empty | 2 - freed into a thread cache
     int checksum;
     int line;
+    int slab_flag; //1 - payload is a slab of small objects
+    const char * filename;
+    struct chunk_t * next_free; //Links inside the free list of the block's bin
+    struct chunk_t * prev_free;
+};
+
+#define chunk_next(chunk) ((chunk) -> next)
+#define chunk_prev(chunk) ((chunk) -> prev)
+#define chunk_set_next(chunk, next_chunk) ((chunk) -> next = (next_chunk))
+#define chunk_set_prev(chunk, prev_chunk) ((chunk) -> prev = (prev_chunk))
+#define chunk_next_free(chunk) ((chunk) -> next_free)
+#define chunk_prev_free(chunk) ((chunk) -> prev_free)
+#define chunk_binnable(chunk) 1
+#define chunk_init_site(chunk) ((chunk) -> line = __LINE__, (chunk) -> filename = __FILE__)
+#define chunk_set_site(arena, chunk, site_line, site_filename) ((chunk) -> line = (site_line), (chunk) -> filename = (site_filename))
+#define chunk_clear_site(arena, chunk) ((void)0)
+#define chunk_line(arena, chunk) ((chunk) -> line)
+#define chunk_filename(arena, chunk) ((chunk) -> filename)
+#endif
+
+struct mapping_t
+{
+    struct chunk_t * chunk; //Header at the start of the mapping
+    size_t length; //Bytes mapped, a multiple of PAGE_SIZE
+    int line;
+    const char * filename;
+};
+
+struct site_t
+{
+    const void * chunk; //Header of the block, NULL for an empty slot
+    const char * filename;
+    int line;
+};
+
+struct site_table_t
+{
+    struct site_t * slots; //Open addressing with linear probing
+    size_t capacity;
+    size_t count;
+};
+
+struct heap_site_stats_t
+{
+    const char * filename; //NULL for an empty slot of the profile table
+    int line;
+    uint64_t live_bytes;
+    uint64_t live_count;
+    uint64_t peak_bytes; //Largest live_bytes seen
+    uint64_t total_bytes; //Bytes of every block allocated so far
+    uint64_t total_count;
+};
+
+struct profile_table_t
+{
+    struct heap_site_stats_t * slots; //Open addressing with linear probing, keyed by filename and line
+    size_t capacity;
+    size_t count;
+};
+
+struct heap_sample_t
+{
+    const void * ptr; //Block the sample was taken for, NULL for an empty slot
+    size_t size; //Bytes asked for
+    uint64_t weight; //Bytes of allocations the sample stands for
+    int line;
     const char * filename;
+    int depth; //Frames in use
+    void * frames[SAMPLE_MAX_FRAMES]; //Return addresses from the public function outwards
+};
+
+//Chunk of a region, the memory handed out follows it
+struct heap_region_chunk_t
+{
+    struct heap_region_chunk_t * next; //Older chunk
+    size_t size; //Bytes of the block holding the chunk
+};
+
+//Bump allocator on chunks carved from the heap, not safe to share between threads without a lock
+struct heap_region_t
+{
+    struct heap_region_chunk_t * chunks; //Newest first, allocations are bumped from the newest
+    char * cursor; //Next free byte of the newest chunk
+    char * end;
+    size_t chunk_size; //Size of the next chunk, doubles up to REGION_MAX_CHUNK
+    int line; //Site of heap_region_create, every chunk is allocated for it
+    const char * filename;
+};
+
+struct sample_table_t
+{
+    struct heap_sample_t * slots; //Open addressing with linear probing, keyed by the block address
+    size_t capacity;
+    size_t count;
+};
+
+struct size_node_t
+{
+    uint32_t size;
+    uint32_t count; //Blocks of this size
+    uint32_t priority;
+    uint32_t left; //Indexes of the children, 0 for none
+    uint32_t right;
+};
+
+struct size_index_t
+{
+    struct size_node_t * nodes; //Treap ordered by size, nodes[0] is unused so 0 can stand for no node
+    uint32_t capacity;
+    uint32_t top; //Nodes handed out so far
+    uint32_t free_list; //Released nodes chained through their right link
+    uint32_t root;
+    uint32_t seed;
+    uint64_t count; //Blocks in the index
+    uint64_t bytes; //Sum of their sizes
+};
+
+struct free_node_t
+{
+    struct chunk_t * chunk;
+    uint32_t size;
+    uint32_t max_size; //Largest block of the subtree
+    uint32_t priority;
+    uint32_t left;
+    uint32_t right;
+};
+
+struct free_tree_t
+{
+    struct free_node_t * nodes; //Treap of the free blocks, nodes[0] is unused so 0 can stand for no node
+    uint32_t capacity;
+    uint32_t top;
+    uint32_t free_list;
+    uint32_t root;
+    uint32_t seed;
+    uint32_t count;
+    int by_size; //1 - ordered by size and address | 0 - ordered by address
+};
+
+//Leaf of the page map, the bitmaps find the nearest page with a chunk before any page in constant time
+struct page_leaf_t
+{
+    struct chunk_t * chunks[1 << PAGE_MAP_LEAF_BITS]; //Lowest chunk starting in every page
+    uint64_t used[(1 << PAGE_MAP_LEAF_BITS) / 64]; //Bit i is set when page i has a chunk
+    uint64_t summary; //Bit i is set when used[i] is not zero
+};
+
+struct slab_t
+{
+    struct slab_t * next; //Links inside the list of slabs with free objects
+    struct slab_t * prev;
+    uint32_t object_size;
+    uint32_t capacity;
+    uint32_t free_count;
+    uint32_t class;
+    uint64_t free_map[SLAB_MAP_WORDS]; //Bit i is set when object i is free
+};
+
+struct thread_cache_t
+{
+    uint64_t generation; //Heap generation the cached blocks belong to
+    int counts[TCACHE_CLASS_COUNT];
+    void * slots[TCACHE_CLASS_COUNT][TCACHE_SLOTS];
+    uint32_t sizes[TCACHE_CLASS_COUNT][TCACHE_SLOTS]; //Payloads of the cached blocks, so a hit doesn't read their headers
+    int lines[TCACHE_CLASS_COUNT][TCACHE_SLOTS]; //Sites of the cached blocks, charged to the profile when a block is handed out
+    const char * filenames[TCACHE_CLASS_COUNT][TCACHE_SLOTS];
 };
 
 typedef struct heap_t
@@ -52,13 +330,214 @@ typedef struct heap_t
     size_t chunk_count;
 } heap;
 
+struct arena_t
+{
+    heap heap;
+    struct chunk_t * free_bins[BIN_COUNT]; //Heads of the segregated free lists
+    uint64_t free_bins_map; //Bit i is set when free_bins[i] is not empty
+    struct page_leaf_t * page_map[PAGE_MAP_ROOT_SIZE]; //First chunk starting in every page of the arena
+    uint64_t page_map_leaves[PAGE_MAP_ROOT_SIZE / 64]; //Bit i is set when leaf i has a page with a chunk
+    uint64_t page_map_summary; //Bit i is set when page_map_leaves[i] is not zero
+    struct slab_t * slabs[SLAB_CLASS_COUNT]; //Slabs with free objects for every size class
+    struct site_table_t sites; //Line and filename of blocks in use when headers don't carry them
+    struct size_index_t free_sizes; //Sizes of the free blocks, kept by bin_insert and bin_remove
+    struct size_index_t used_sizes; //Sizes of the blocks in use, objects of a slab count with the size of their class
+    size_t slab_free_space; //Bytes of the free objects of all slabs
+    uint64_t free_gaps_count;
+    enum placement_policy_t placement;
+    struct free_tree_t free_tree; //Free blocks for every policy except good fit, which uses the bins alone
+    char * rover; //Last placed block for next fit
+    pthread_mutex_t lock;
+    void * reserve; //Address space of the arena, NULL for the first arena which uses custom_sbrk
+    size_t reserve_used;
+    uint64_t contention; //Times a thread found the lock taken
+    int threads; //Threads assigned to the arena
+    void * remote_frees[REMOTE_FREE_SLOTS]; //Blocks freed by threads of other arenas, each slot filled with a CAS without the lock
+    uint64_t remote_free_count; //Slots filled since the last drain, counted after the slot is filled
+};
+
+struct latency_histogram_t
+{
+    uint64_t counts[LATENCY_BUCKET_COUNT]; //Bucket i counts the times below 2^i ticks, bucket 0 the times of 0
+    uint64_t samples;
+    uint64_t total_ticks;
+    uint64_t max_ticks;
+};
+
+struct latency_table_t
+{
+    struct latency_histogram_t histograms[LATENCY_KIND_COUNT]; //Written by the owning thread only
+    struct latency_table_t * next;
+    int owned; //0 once the thread exited, the next new thread takes the table over
+};
+
+struct heap_arena_stats_t
+{
+    size_t heap_size;
+    size_t used_space;
+    size_t free_space;
+    size_t largest_used_block_size;
+    size_t largest_free_area;
+    uint64_t used_blocks_count;
+    uint64_t free_gaps_count;
+    uint64_t contention;
+    int threads;
+};
+
+void heap_message(const char * format, ...) __attribute__((format(printf, 1, 2)));
 uint32_t add_bytes(void * ptr, uint32_t data_size);
-struct chunk_t * find_suitable_block(uint32_t needed_space);
-struct chunk_t * heap_get_last_block();
+uint32_t byte_sum(const void * ptr, uint32_t data_size);
+uint32_t checksum_select(const void * ptr, uint32_t data_size);
+uint32_t crc32c_portable(const void * ptr, uint32_t data_size);
+#if defined(__x86_64__)
+uint32_t crc32c_sse42(const void * ptr, uint32_t data_size);
+#endif
+size_t bin_index(size_t size);
+void bin_insert(struct arena_t * arena, struct chunk_t * chunk);
+void bin_remove(struct arena_t * arena, struct chunk_t * chunk);
+struct chunk_t ** page_map_slot(struct arena_t * arena, const void * address, int create);
+void page_map_add(struct arena_t * arena, struct chunk_t * chunk);
+void page_map_remove(struct arena_t * arena, struct chunk_t * chunk);
+void page_map_clear(struct arena_t * arena);
+void page_map_mark(struct arena_t * arena, const void * address, int used);
+int64_t page_map_previous(struct arena_t * arena, size_t page);
+struct chunk_t * page_map_find(struct arena_t * arena, const void * address);
+struct chunk_t * find_suitable_block(struct arena_t * arena, uint32_t needed_space);
+struct chunk_t * heap_get_last_block(struct arena_t * arena);
 size_t page_size(size_t number);
-int coalesce_blocks(struct chunk_t * temp);
-void split(struct chunk_t * chunk, size_t bytes);
+int coalesce_blocks(struct arena_t * arena, struct chunk_t * temp);
+void split(struct arena_t * arena, struct chunk_t * chunk, size_t bytes);
 size_t get_payload_size(void * ptr);
+void * allocate_block(struct arena_t * arena, size_t bytes, int line, const char * filename);
+void release_block(struct arena_t * arena, void * ptr);
+void release_chunk(struct arena_t * arena, struct chunk_t * temp);
+int region_grow(struct heap_region_t * region, size_t bytes);
+void region_release_chunks(struct heap_region_chunk_t * chunk);
+void release_sized(void * ptr, size_t size);
+void arena_shrink(struct arena_t * arena, struct chunk_t * freed);
+void carve_blocks(struct arena_t * arena, struct chunk_t * chunk, size_t bytes, size_t count, void ** pointers, int line, const char * filename);
+void release_sorted(void ** pointers, size_t count);
+void arena_release_run(struct arena_t * arena, void ** pointers, size_t count);
+int compare_pointers(const void * a, const void * b);
+int resize_block(struct arena_t * arena, void * ptr, size_t new_size);
+void * realloc_block(void * ptr, size_t new_size, size_t alignment, int line, const char * filename);
+void * arena_memalign(struct arena_t * arena, size_t alignment, size_t bytes, int line, const char * filename);
+void release_blocks(void ** pointers, int count);
+int remote_free_push(struct arena_t * arena, void * ptr);
+void remote_free_drain(struct arena_t * arena);
+void read_environment(void);
+
+int arena_setup(struct arena_t * arena);
+int arena_reset(struct arena_t * arena);
+size_t arena_trim(struct arena_t * arena, size_t pad);
+int arena_validate(struct arena_t * arena);
+int chunk_validate(struct arena_t * arena, struct chunk_t * chunk);
+int validation_due(void);
+int heap_check(void);
+int arena_check(struct arena_t * arena);
+int chunk_check(struct arena_t * arena, struct chunk_t * chunk);
+void * arena_sbrk(struct arena_t * arena, intptr_t delta);
+void arena_lock(struct arena_t * arena);
+struct arena_t * arena_of(const void * pointer);
+struct arena_t * thread_arena(void);
+struct arena_t * lock_thread_arena(void);
+enum pointer_type_t arena_pointer_type(struct arena_t * arena, const void * pointer);
+void * arena_data_block_start(struct arena_t * arena, const void * pointer);
+void arena_get_stats(struct arena_t * arena, struct heap_arena_stats_t * stats);
+void arena_count_stats(struct arena_t * arena, struct heap_arena_stats_t * stats);
+void chunk_count_stats(struct chunk_t * chunk, struct heap_arena_stats_t * stats);
+uint32_t size_node_new(struct size_index_t * index, uint32_t size);
+uint32_t size_node_insert(struct size_index_t * index, uint32_t node, uint32_t size);
+uint32_t size_node_merge(struct size_index_t * index, uint32_t left, uint32_t right);
+uint32_t size_node_remove(struct size_index_t * index, uint32_t node, uint32_t size);
+void size_index_add(struct size_index_t * index, size_t size);
+void size_index_remove(struct size_index_t * index, size_t size);
+size_t size_index_max(const struct size_index_t * index);
+void * node_pool_grow(void * nodes, uint32_t * capacity, uint32_t top, size_t node_size);
+int free_node_before(const struct free_tree_t * tree, uint32_t size, const struct chunk_t * chunk, uint32_t node);
+void free_node_update(struct free_tree_t * tree, uint32_t node);
+uint32_t free_node_insert(struct free_tree_t * tree, uint32_t node, uint32_t created);
+uint32_t free_node_merge(struct free_tree_t * tree, uint32_t left, uint32_t right);
+uint32_t free_node_remove(struct free_tree_t * tree, uint32_t node, uint32_t size, const struct chunk_t * chunk);
+uint32_t free_node_first(const struct free_tree_t * tree, uint32_t node, uint32_t needed_space, const char * from);
+uint32_t free_node_smallest(const struct free_tree_t * tree, uint32_t size);
+void free_tree_insert(struct free_tree_t * tree, struct chunk_t * chunk);
+void free_tree_remove(struct free_tree_t * tree, struct chunk_t * chunk);
+void free_tree_clear(struct free_tree_t * tree, int by_size);
+struct chunk_t * free_tree_find(struct arena_t * arena, uint32_t needed_space);
+void size_index_clear(struct size_index_t * index);
+int heap_collect_stats(struct heap_arena_stats_t * total);
+
+void * slab_alloc(struct arena_t * arena, size_t bytes, int line, const char * filename);
+void slab_free(struct arena_t * arena, struct chunk_t * chunk, void * ptr);
+struct slab_t * slab_of(struct chunk_t * chunk);
+enum pointer_type_t slab_pointer_type(struct chunk_t * chunk, const void * pointer);
+size_t arena_block_size(struct arena_t * arena, const void * pointer);
+
+void site_table_set(struct arena_t * arena, struct chunk_t * chunk, int line, const char * filename);
+void site_table_remove(struct arena_t * arena, struct chunk_t * chunk);
+size_t site_slot(const struct site_table_t * table, const void * chunk);
+struct site_t * site_table_find(struct arena_t * arena, const struct chunk_t * chunk);
+void site_table_clear(struct arena_t * arena);
+int site_line(struct arena_t * arena, const struct chunk_t * chunk);
+const char * site_filename(struct arena_t * arena, const struct chunk_t * chunk);
+size_t profile_slot(const struct profile_table_t * table, int line, const char * filename);
+struct heap_site_stats_t * profile_find(int line, const char * filename, int create);
+void profile_update(int line, const char * filename, int64_t bytes, int count);
+void profile_chunk(struct arena_t * arena, struct chunk_t * chunk, int64_t bytes, int count);
+void profile_clear(void);
+int profile_compare(const void * a, const void * b);
+struct heap_site_stats_t * profile_sorted(size_t * count);
+void profile_free_sorted(struct heap_site_stats_t * sites, size_t count);
+size_t sample_slot(size_t capacity, const void * ptr);
+uint64_t sample_random(void);
+double sample_log2(uint64_t x);
+int64_t sample_next_interval(void);
+uint64_t sample_weight(size_t size);
+struct heap_sample_t * sample_find(const void * ptr);
+int sample_insert(const struct heap_sample_t * sample);
+void sample_remove(struct heap_sample_t * sample);
+void sample_allocation(void * ptr, size_t bytes, int line, const char * filename);
+int sample_filtered(const void * ptr);
+void sample_forget(const void * ptr);
+void sample_move(const void * ptr, void * moved);
+void sample_clear(void);
+
+void * mapping_alloc(size_t bytes, int line, const char * filename);
+void * mapping_resize(void * ptr, size_t new_size);
+int mapping_release(void * ptr);
+void mapping_release_all(void);
+int mapping_find(const void * pointer);
+enum pointer_type_t mapping_pointer_type(const void * pointer);
+void * mapping_data_block_start(const void * pointer);
+int mapping_validate(struct mapping_t * mapping);
+int mappings_validate(void);
+void mappings_get_stats(struct heap_arena_stats_t * stats);
+
+void * thread_cache_get(size_t bytes);
+int thread_cache_put(void * ptr, size_t bytes);
+void thread_cache_refill(struct arena_t * arena, size_t bytes, int line, const char * filename);
+void thread_cache_flush(void);
+void thread_cache_mark(struct arena_t * arena, struct chunk_t * chunk, int cached);
+void thread_cache_release(void ** pointers, int count);
+void thread_register(void);
+int snapshot_write(int fd, const void * data, size_t length);
+int snapshot_section(int fd, uint32_t kind, int index, const void * start, uint64_t length, const void * records, uint64_t count);
+int snapshot_filenames(int fd, const char ** filenames, size_t count);
+int snapshot_compare_filenames(const void * a, const void * b);
+uint64_t latency_now(void);
+uint64_t latency_start(void);
+void latency_record(enum latency_kind_t kind, uint64_t start);
+uint64_t latency_enter(void);
+void latency_leave(enum latency_kind_t kind, uint64_t start);
+struct latency_table_t * latency_table(void);
+void latency_table_release(void);
+void * malloc_request(size_t bytes, int line, const char * filename);
+void * calloc_request(size_t n, size_t size_of_element, int line, const char * filename);
+void * realloc_request(void * ptr, size_t new_size, int line, const char * filename);
+void * memalign_request(size_t alignment, size_t bytes, int line, const char * filename);
+void thread_create_key(void);
+void thread_destroy(void * unused);
 
 void destroy_mutex(void);
 int heap_reset(void);
@@ -66,7 +545,43 @@ int heap_validate(void);
 int heap_setup(void);
 
 void heap_free(void *);
+size_t heap_malloc_batch_debug(size_t bytes, size_t count, void ** pointers, int line, const char * filename);
+void heap_free_batch(void ** pointers, size_t count);
+void heap_free_sized(void * ptr, size_t size);
+struct heap_region_t * heap_region_create_debug(size_t initial_size, int line, const char * filename);
+void * heap_region_alloc(struct heap_region_t * region, size_t size, size_t alignment);
+void heap_region_reset(struct heap_region_t * region);
+void heap_region_destroy(struct heap_region_t * region);
+void heap_set_thread_cache(int enabled);
+void heap_set_slab(int enabled);
+void heap_set_remote_free(int enabled);
+void heap_set_site_table(int enabled);
+void heap_set_site_profile(int enabled);
+int heap_get_site_profile(struct heap_site_stats_t * sites, int capacity);
+int heap_dump_site_profile(FILE * out, enum profile_format_t format);
+void heap_set_sample_interval(size_t bytes);
+int heap_get_samples(struct heap_sample_t * samples, int capacity);
+int heap_dump_samples(const char * path);
+void heap_set_mmap_threshold(size_t bytes);
+void heap_set_trim_threshold(size_t bytes);
+size_t heap_trim(size_t pad);
+uint64_t heap_get_trimmed_bytes(void);
+void heap_set_validation_mode(enum validation_mode_t mode, int period);
+enum validation_mode_t heap_get_validation_mode(void);
+uint64_t heap_get_validation_count(void);
+void heap_set_arena_count(int count);
+void heap_set_placement_policy(enum placement_policy_t policy);
+void heap_set_messages(int enabled);
+enum placement_policy_t heap_get_placement_policy(void);
+int heap_get_arena_count(void);
+int heap_get_arena_stats(int index, struct heap_arena_stats_t * stats);
 void heap_dump_debug_information(void);
+int heap_write_snapshot(int fd);
+void heap_set_latency_tracking(int enabled);
+int heap_get_latency_histogram(enum latency_kind_t kind, struct latency_histogram_t * histogram);
+uint64_t heap_latency_percentile(const struct latency_histogram_t * histogram, double fraction);
+void heap_reset_latency_histograms(void);
+void heap_dump_latency_histograms(void);
 
 void * heap_malloc_debug(size_t, int, const char *);
 void * heap_calloc_debug(size_t, size_t, int, const char *);
@@ -75,6 +590,9 @@ void * heap_realloc_debug(void *, size_t, int, const char *);
 void * heap_malloc_aligned_debug(size_t, int, const char *);
 void * heap_calloc_aligned_debug(size_t, size_t, int, const char *);
 void * heap_realloc_aligned_debug(void *, size_t, int, const char *);
+void * heap_memalign_debug(size_t, size_t, int, const char *);
+void * heap_calloc_memalign_debug(size_t, size_t, size_t, int, const char *);
+void * heap_realloc_memalign_debug(size_t, void *, size_t, int, const char *);
 
 void * heap_get_data_block_start(const void * pointer);
 
@@ -0,0 +1,138 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "malloc.h"
+
+//Standard malloc family on top of the heap, built as a shared library for LD_PRELOAD:
+//gcc -O2 -fPIC -shared -DHEAP_PRELOAD -o libheap.so preload.c malloc.c -lpthread
+
+#ifndef HEAP_PRELOAD
+#error "preload.c has to be built with -DHEAP_PRELOAD"
+#endif
+
+#define PRELOAD_ALIGNMENT 16 //Alignment malloc guarantees, payloads keep it when sizes are multiples of it
+#define PRELOAD_MMAP_THRESHOLD (128 * 1024) //Same default as glibc, HEAP_MMAP_THRESHOLD overrides it
+
+pthread_once_t preloadOnce = PTHREAD_ONCE_INIT;
+int preloadReady = 0;
+
+void preload_setup(void)
+{
+    //Defaults fit a process using the heap as its malloc, the environment read by heap_setup overrides them
+    heap_set_messages(0);
+    heap_set_validation_mode(validation_off, VALIDATION_DEFAULT_PERIOD);
+    heap_set_mmap_threshold(PRELOAD_MMAP_THRESHOLD);
+
+    //Program break starts the first arena on a page boundary
+    uintptr_t brk = (uintptr_t)sbrk(0);
+    if (brk % PAGE_SIZE) sbrk(PAGE_SIZE - brk % PAGE_SIZE);
+
+    if (heap_setup() == 0) preloadReady = 1;
+}
+
+int preload_ready(void)
+{
+    pthread_once(&preloadOnce, preload_setup);
+    return preloadReady;
+}
+
+size_t preload_size(size_t size)
+{
+    //0 byte blocks still get a unique pointer, SIZE_MAX stands for a size too large to serve
+    if (size == 0) return PRELOAD_ALIGNMENT;
+    if (size > CHUNK_MAX_SIZE) return SIZE_MAX;
+    return (size + PRELOAD_ALIGNMENT - 1) & ~(size_t)(PRELOAD_ALIGNMENT - 1);
+}
+
+void * preload_memalign(size_t alignment, size_t size)
+{
+    if (!preload_ready()) return NULL;
+
+    size = preload_size(size);
+    void * ptr = NULL;
+    if (size != SIZE_MAX)
+    {
+        if (alignment <= PRELOAD_ALIGNMENT) ptr = heap_malloc_debug(size, __LINE__, __FILE__);
+        else ptr = heap_memalign_debug(alignment, size, __LINE__, __FILE__);
+    }
+    if (ptr == NULL) errno = ENOMEM;
+    return ptr;
+}
+
+void * malloc(size_t size)
+{
+    return preload_memalign(PRELOAD_ALIGNMENT, size);
+}
+
+void free(void * ptr)
+{
+    if (ptr == NULL || !preload_ready()) return;
+    heap_free(ptr);
+}
+
+void * calloc(size_t n, size_t size)
+{
+    if (size && n > SIZE_MAX / size)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void * ptr = preload_memalign(PRELOAD_ALIGNMENT, n * size);
+    if (ptr) memset(ptr, 0, n * size);
+    return ptr;
+}
+
+void * realloc(void * ptr, size_t size)
+{
+    if (ptr == NULL) return malloc(size);
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+    if (!preload_ready()) return NULL;
+
+    size = preload_size(size);
+    void * res = size == SIZE_MAX ? NULL : realloc_block(ptr, size, 0, __LINE__, __FILE__);
+    if (res == NULL) errno = ENOMEM;
+    return res;
+}
+
+int posix_memalign(void ** memptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+
+    void * ptr = preload_memalign(alignment, size);
+    if (ptr == NULL) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void * aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return preload_memalign(alignment, size);
+}
+
+void * memalign(size_t alignment, size_t size)
+{
+    //Not asked for by the standard, but programs calling it would otherwise get blocks from another allocator
+    return aligned_alloc(alignment, size);
+}
+
+void * valloc(size_t size)
+{
+    return preload_memalign(PAGE_SIZE, size);
+}
+
+size_t malloc_usable_size(void * ptr)
+{
+    if (ptr == NULL || !preload_ready()) return 0;
+    return heap_get_block_size(ptr);
+}
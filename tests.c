@@ -5,9 +5,60 @@
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <unistd.h>
 #include "malloc.h"
 
 
+void * thread_cache_worker(void * arg)
+{
+    //Everything cached by this thread must go back to the heap when it exits
+    for (int i = 0; i < 100; i++)
+    {
+        void * ptr = heap_malloc(16 + i % 4 * 8);
+        heap_free(ptr);
+    }
+    return NULL;
+}
+
+void * thread_cache_double_free_worker(void * arg)
+{
+    //Frees a block another thread already freed into its cache, then allocates a block of the same size
+    void ** block = arg;
+    heap_free(*block);
+    *block = heap_malloc(40);
+    return NULL;
+}
+
+void * arena_worker(void * arg)
+{
+    *(void **)arg = heap_malloc(40);
+    return NULL;
+}
+
+void * remote_free_worker(void * arg)
+{
+    //Frees blocks of the main thread's arena without ever allocating, so every free is a remote one
+    void ** blocks = arg;
+    for (int i = 0; blocks[i]; i++) heap_free(blocks[i]);
+    return NULL;
+}
+
+long free_sized_report(void * ptr, size_t size)
+{
+    //Frees the block with heap_free_sized and returns how many bytes it reported
+    FILE * log = tmpfile();
+    int out = dup(1);
+    fflush(stdout);
+    dup2(fileno(log), 1);
+    heap_free_sized(ptr, size);
+    fflush(stdout);
+    dup2(out, 1);
+    close(out);
+    long reported = lseek(fileno(log), 0, SEEK_END);
+    fclose(log);
+    return reported;
+}
+
 int main(int argc, char **argv)
 {
     //####################################################################
@@ -149,8 +200,10 @@ int main(int argc, char **argv)
         assert(get_pointer_type(testRA) == pointer_valid);
         assert((intptr_t)testRA % PAGE_SIZE == 0);
 
-        int * testRA2 = heap_realloc_aligned(testRA, 16); //Shouldn't allocate new block
-        assert(get_pointer_type(testRA2) == pointer_null);
+        int * testRA2 = heap_realloc_aligned(testRA, 16); //Grows in place so it stays aligned
+        assert(testRA2 == testRA);
+        assert(get_pointer_type(testRA2) == pointer_valid);
+        assert(get_payload_size(testRA2) == 16);
 
     //####################################################################
 
@@ -185,7 +238,22 @@ int main(int argc, char **argv)
 
         // //Create pointers for breaching heap integrity
         struct chunk_t * block = ((struct chunk_t *)((char *)testV2 - move_to_data_block));
-        struct chunk_t * block2 = block -> next;
+        struct chunk_t * block2 = chunk_next(block);
+#ifdef HEAP_COMPACT_HEADER
+        //Corrupting the boundary tags neighbours are found from
+        block -> last_flag = 1; //Heap seems to end early
+        assert(heap_validate() < 0);
+        block -> last_flag = 0; //Restore heap integrity
+
+        block2 -> prev_size += 8; //Points into the middle of the previous block
+        assert(heap_validate() < 0);
+        block2 -> prev_size -= 8; //Restore heap integrity
+
+        block2 -> first_flag = 1;
+        assert(heap_validate() < 0);
+        block2 -> first_flag = 0; //Restore heap integrity
+
+#else
         struct chunk_t * next = ((struct chunk_t *)((char *)testV2 - move_to_data_block)) -> next;
         struct chunk_t * prev = ((struct chunk_t *)((char *)testV2 - move_to_data_block)) -> prev;
         struct chunk_t * next2 = ((struct chunk_t *)((char *)testV2_1 - move_to_data_block)) -> next;
@@ -207,6 +275,7 @@ int main(int argc, char **argv)
         block2 -> prev = NULL; //Assign wrong pointer
         assert(heap_validate() < 0);
         block2 -> prev = prev2; //Restore heap integrity
+#endif
 
         //Corrupting checksums
         block -> checksum += 1; 
@@ -374,6 +443,903 @@ int main(int argc, char **argv)
 
     heap_reset();
 
+    //####################################################################
+    //                          FREE_LISTS
+
+        void * testFL = heap_malloc(100);
+        void * testFL2 = heap_malloc(10); //Keeps the freed block from merging with the tail
+        void * testFL3 = heap_malloc(300);
+        heap_free(testFL);
+
+        void * testFL4 = heap_malloc(100); //Should reuse the freed block
+        assert(testFL4 == testFL);
+
+        heap_free(testFL3);
+        void * testFL5 = heap_malloc(50); //Should be carved from the coalesced tail
+        assert(testFL5 == testFL3);
+        assert(get_pointer_type(testFL2) == pointer_valid && get_payload_size(testFL2) == 10);
+        assert(heap_validate() == 0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                          THREAD_CACHE
+
+        heap_set_thread_cache(1);
+
+        void * testTC = heap_malloc(24);
+        assert(testTC != NULL);
+        heap_free(testTC);
+        assert(get_pointer_type(testTC) == pointer_unallocated); //Block waits in the thread cache, marked as freed
+
+        void * testTC2 = heap_malloc(24); //Should be served from the cache
+        assert(testTC2 == testTC);
+        heap_free(testTC2);
+
+        pthread_t testTCThread;
+        assert(pthread_create(&testTCThread, NULL, thread_cache_worker, NULL) == 0);
+        pthread_join(testTCThread, NULL);
+
+        //A second free from another thread is reported instead of caching the block twice
+        void * testTCTwice = heap_malloc(40);
+        heap_free(testTCTwice);
+        void * testTCOther = testTCTwice;
+        assert(pthread_create(&testTCThread, NULL, thread_cache_double_free_worker, &testTCOther) == 0);
+        pthread_join(testTCThread, NULL);
+        void * testTCOwn = heap_malloc(40);
+        assert(testTCOwn == testTCTwice && testTCOther != testTCTwice);
+        heap_free(testTCOwn);
+        heap_free(testTCOther);
+
+        heap_set_thread_cache(0); //Gives cached blocks back to the heap
+        assert(get_pointer_type(testTC) != pointer_valid);
+        assert(heap_get_used_blocks_count() == 0);
+        assert(heap_validate() == 0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                             ARENAS
+
+        heap_set_arena_count(2);
+
+        void * testAR = NULL;
+        pthread_t testARThread;
+        assert(pthread_create(&testARThread, NULL, arena_worker, &testAR) == 0);
+        pthread_join(testARThread, NULL);
+        assert(testAR != NULL);
+
+        struct heap_arena_stats_t arena_stats;
+        assert(heap_get_arena_stats(1, &arena_stats) == 0);
+        assert(arena_stats.used_blocks_count == 1); //Second thread got the second arena
+        assert(arena_stats.largest_used_block_size == 40);
+        assert(get_pointer_type(testAR) == pointer_valid);
+        assert(heap_get_used_blocks_count() == 1);
+
+        heap_free(testAR); //Goes back to the arena which owns it
+        assert(heap_get_arena_stats(1, &arena_stats) == 0);
+        assert(arena_stats.used_blocks_count == 0);
+        assert(heap_validate() == 0);
+
+        heap_set_arena_count(1);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                            PAGE_MAP
+
+        void * testPM = heap_malloc(PAGE_SIZE * 3); //Spans pages with no chunk starting in them
+        void * testPM2 = heap_malloc(8);
+        void * testPM3 = heap_malloc(8); //Shares a page with testPM2
+        assert(testPM != NULL && testPM2 != NULL && testPM3 != NULL);
+
+        assert(get_pointer_type((char *)testPM + PAGE_SIZE * 2 + 5) == pointer_inside_data_block);
+        assert(heap_get_data_block_start((char *)testPM + PAGE_SIZE * 2 + 5) == (char *)testPM - move_to_data_block);
+        assert(get_pointer_type((char *)testPM3 - fence_size - 1) == pointer_control_block);
+        assert(get_pointer_type((char *)testPM2 + 1) == pointer_inside_data_block);
+
+        heap_free(testPM2); //testPM3 becomes the first chunk of its page
+        assert(get_pointer_type(testPM2) == pointer_unallocated);
+        assert(get_pointer_type(testPM3) == pointer_valid);
+
+        heap_free(testPM); //Merges with testPM2, dropping its header from the map
+        assert(get_pointer_type((char *)testPM + PAGE_SIZE * 3) == pointer_inside_data_block);
+        assert(get_pointer_type(testPM3) == pointer_valid);
+        heap_free(testPM3);
+        assert(heap_validate() == 0);
+
+        //Leaves of the map with no chunk at all are skipped through their bitmaps
+        void * testPMLarge = heap_malloc(20 * 1024 * 1024);
+        assert(testPMLarge != NULL);
+        assert(heap_get_data_block_start((char *)testPMLarge + 18 * 1024 * 1024) == (char *)testPMLarge - move_to_data_block);
+        assert(get_pointer_type((char *)testPMLarge + 20 * 1024 * 1024 - 1) == pointer_inside_data_block);
+        heap_free(testPMLarge);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                           VALIDATION
+
+        heap_set_validation_mode(validation_off, 0);
+        void * testVA = heap_malloc(64); //Keeps the arena from being reset, which always validates
+        uint64_t validations = heap_get_validation_count();
+        void * testVA2 = heap_malloc(64);
+        heap_free(testVA2);
+        assert(heap_get_validation_count() == validations);
+        heap_free(testVA);
+
+        heap_set_validation_mode(validation_sampled, 4);
+        validations = heap_get_validation_count();
+        for (int i = 0; i < 8; i++) get_pointer_type(NULL);
+        assert(heap_get_validation_count() == validations + 2); //Every 4th call walks the heap
+
+        heap_set_validation_mode(validation_local, 0);
+        testVA = heap_malloc(64);
+        testVA2 = heap_malloc(64);
+        validations = heap_get_validation_count();
+        ((char *)testVA)[64] = 'x'; //Breaks the right fence
+        heap_free(testVA); //Should be refused as the block is broken
+        assert(heap_get_validation_count() > validations);
+        assert(get_pointer_type(testVA) == pointer_valid);
+        ((char *)testVA)[64] = 0;
+        heap_free(testVA);
+        heap_free(testVA2);
+
+        heap_set_validation_mode(validation_full, VALIDATION_DEFAULT_PERIOD);
+        assert(heap_get_validation_mode() == validation_full);
+        assert(heap_get_used_blocks_count() == 0);
+        assert(heap_validate() == 0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                            CHECKSUM
+
+        char testCS[] = "123456789"; //Standard CRC32C check value
+        assert(crc32c_portable(testCS, 9) == 0xE3069283);
+        assert(add_bytes(testCS, 9) == 0xE3069283);
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("sse4.2")) assert(crc32c_sse42(testCS, 9) == 0xE3069283);
+#endif
+
+        char testCS2[61]; //Odd length covers the byte tail of the kernels
+        for (int i = 0; i < 61; i++) testCS2[i] = (char)(i * 7);
+        assert(add_bytes(testCS2, 61) == crc32c_portable(testCS2, 61));
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                              SLAB
+
+        heap_set_slab(1);
+
+        void * testSL = heap_malloc(4);
+        void * testSL2 = heap_malloc(10); //Same 16 byte class, no header in between
+        void * testSL3 = heap_malloc(200);
+        assert(testSL != NULL && testSL2 != NULL && testSL3 != NULL);
+        assert((char *)testSL2 - (char *)testSL == 16);
+        assert(get_pointer_type(testSL) == pointer_valid);
+        assert(get_pointer_type((char *)testSL + 3) == pointer_inside_data_block);
+        assert(heap_get_block_size(testSL2) == 16);
+        assert(heap_get_block_size(testSL3) == 208);
+        assert(heap_get_used_blocks_count() == 3);
+        size_t slab_used = heap_get_used_space();
+
+        heap_free(testSL2);
+        assert(get_pointer_type(testSL2) == pointer_unallocated);
+        assert(heap_get_used_space() == slab_used - 16); //Free slots count as free space
+        void * testSL4 = heap_malloc(16); //First free bit is the slot just freed
+        assert(testSL4 == testSL2);
+
+        void * testSL5[300]; //Fills more than one slab of the class
+        for (int i = 0; i < 300; i++) testSL5[i] = heap_malloc(16);
+        for (int i = 0; i < 300; i++) assert(testSL5[i] != NULL && get_pointer_type(testSL5[i]) == pointer_valid);
+        for (int i = 0; i < 300; i++) heap_free(testSL5[i]);
+        assert(heap_validate() == 0);
+
+        heap_free(testSL);
+        heap_free(testSL3);
+        heap_free(testSL4); //Last object gives the slabs back to the heap
+        assert(heap_get_used_blocks_count() == 0);
+        assert(heap_validate() == 0);
+
+        heap_set_slab(0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                           SITE_TABLE
+
+#ifdef HEAP_COMPACT_HEADER
+        assert(sizeof(struct chunk_t) == 16);
+#endif
+        static struct arena_t testST; //Only its site table is used
+        struct chunk_t * testSTChunks = (struct chunk_t *)0x100000; //Keys are never dereferenced
+
+        for (int i = 0; i < 3000; i++) site_table_set(&testST, testSTChunks + i, i, "tests.c");
+        assert(testST.sites.count == 3000);
+        for (int i = 0; i < 3000; i += 2) site_table_remove(&testST, testSTChunks + i);
+        assert(testST.sites.count == 1500);
+        for (int i = 0; i < 3000; i++)
+        {
+            if (i % 2) assert(site_line(&testST, testSTChunks + i) == i);
+            else assert(site_table_find(&testST, testSTChunks + i) == NULL);
+        }
+
+        site_table_set(&testST, testSTChunks + 1, 7, "other.c"); //Updates the entry in place
+        assert(testST.sites.count == 1500);
+        assert(strcmp(site_filename(&testST, testSTChunks + 1), "other.c") == 0);
+        site_table_clear(&testST);
+        assert(site_table_find(&testST, testSTChunks + 1) == NULL);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                              MMAP
+
+        heap_set_mmap_threshold(1024 * 1024);
+        size_t mmap_used = heap_get_used_space();
+
+        char * testMM = heap_malloc(8 * 1024 * 1024); //Gets a mapping of its own
+        char * testMM2 = heap_malloc(100); //Stays in the heap
+        assert(testMM != NULL && testMM2 != NULL);
+        assert(heap_get_data_block_start(testMM) != heap_get_data_block_start(testMM2));
+        assert(get_pointer_type(testMM) == pointer_valid);
+        assert(get_pointer_type(testMM + 1000) == pointer_inside_data_block);
+        assert(get_pointer_type(testMM - 1) == pointer_control_block);
+        assert(heap_get_block_size(testMM) == 8 * 1024 * 1024);
+        assert(heap_get_used_blocks_count() == 2);
+        assert(heap_get_largest_used_block_size() == 8 * 1024 * 1024);
+        assert(heap_get_used_space() >= mmap_used + 8 * 1024 * 1024);
+        memset(testMM, 1, 8 * 1024 * 1024);
+        assert(heap_validate() == 0);
+
+        testMM[8 * 1024 * 1024] = 'x'; //Breaks the right fence
+        assert(heap_validate() < 0);
+        testMM[8 * 1024 * 1024] = 0;
+
+        heap_free(testMM); //Unmapped right away
+        assert(get_pointer_type(testMM) == pointer_out_of_heap);
+        assert(heap_get_used_blocks_count() == 1);
+        heap_free(testMM2);
+        assert(heap_get_used_space() == mmap_used);
+
+        testMM = heap_malloc(2 * 1024 * 1024);
+        heap_reset(); //Gives the mappings back as well
+        assert(heap_get_used_blocks_count() == 0);
+        assert(get_pointer_type(testMM) == pointer_out_of_heap);
+
+        heap_set_mmap_threshold(0);
+        assert(heap_validate() == 0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                              TRIM
+
+        void * testTR = heap_malloc(100); //Keeps the heap from being reset
+        uint64_t trimmed = heap_get_trimmed_bytes();
+
+        void * testTR2 = heap_malloc(1024 * 1024);
+        heap_free(testTR2); //Free tail is larger than the threshold
+        assert(heap_get_trimmed_bytes() > trimmed);
+        assert(heap_get_free_space() < TRIM_DEFAULT_THRESHOLD);
+        assert(heap_validate() == 0);
+
+        heap_set_trim_threshold(0);
+        testTR2 = heap_malloc(1024 * 1024);
+        heap_free(testTR2); //Nothing is trimmed without a threshold
+        assert(heap_get_free_space() > 1024 * 1024);
+
+        trimmed = heap_get_trimmed_bytes();
+        size_t returned = heap_trim(PAGE_SIZE);
+        assert(returned >= 1024 * 1024);
+        assert(heap_get_trimmed_bytes() == trimmed + returned);
+        assert(heap_get_free_space() < PAGE_SIZE * 2);
+        assert(heap_trim(PAGE_SIZE) == 0);
+        assert(heap_validate() == 0);
+
+        testTR2 = heap_malloc(1024 * 1024); //Heap grows again after trimming
+        assert(testTR2 != NULL);
+        heap_free(testTR2);
+        heap_free(testTR);
+        heap_set_trim_threshold(TRIM_DEFAULT_THRESHOLD);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                        REALLOC_IN_PLACE
+
+        char * testRP = heap_malloc(1000);
+        char * testRP2 = heap_malloc(100);
+        memset(testRP, 'a', 1000);
+
+        char * testRP3 = heap_realloc(testRP, 200); //Shrinks by splitting off the tail
+        assert(testRP3 == testRP);
+        assert(heap_get_block_size(testRP) == 200);
+        assert(get_pointer_type(testRP + 200 + metadata_size) == pointer_unallocated);
+
+        testRP3 = heap_realloc(testRP, 600); //Takes back the free space on the right
+        assert(testRP3 == testRP);
+        assert(heap_get_block_size(testRP) == 600);
+        assert(testRP[199] == 'a');
+
+        testRP3 = heap_realloc(testRP, 2000); //testRP2 is in the way so the block moves
+        assert(testRP3 != testRP);
+        assert(heap_get_block_size(testRP3) == 2000);
+        assert(testRP3[0] == 'a' && testRP3[599] == 'a');
+        assert(get_pointer_type(testRP) != pointer_valid);
+
+        char * testRP4 = heap_realloc(testRP3, 64 * 1024); //Last block grows past the end of heap
+        assert(testRP4 == testRP3);
+        assert(heap_get_block_size(testRP4) == 64 * 1024);
+        assert(testRP4[599] == 'a');
+        assert(heap_validate() == 0);
+
+        heap_free(testRP2);
+        heap_free(testRP4);
+        assert(heap_get_used_blocks_count() == 0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                         REALLOC_REMAP
+
+        heap_set_mmap_threshold(1024 * 1024);
+
+        char * testRM = heap_malloc(2 * 1024 * 1024);
+        memset(testRM, 'r', 2 * 1024 * 1024);
+
+        char * testRM2 = heap_realloc(testRM, 64 * 1024 * 1024); //Larger than the whole heap, remapped
+        assert(testRM2 != NULL);
+        assert(get_pointer_type(testRM2) == pointer_valid);
+        assert(heap_get_block_size(testRM2) == 64 * 1024 * 1024);
+        assert(testRM2[0] == 'r' && testRM2[2 * 1024 * 1024 - 1] == 'r');
+        testRM2[64 * 1024 * 1024 - 1] = 'e';
+        assert(heap_validate() == 0);
+
+        testRM = heap_realloc(testRM2, 1024 * 1024 + 10); //Shrinks the mapping
+        assert(testRM != NULL);
+        assert(heap_get_block_size(testRM) == 1024 * 1024 + 10);
+        assert(testRM[1024 * 1024 + 9] == 'r');
+        assert(heap_get_largest_used_block_size() == 1024 * 1024 + 10);
+        assert(heap_validate() == 0);
+
+        testRM2 = heap_realloc(testRM, 1024 * 1024 + 20); //Same pages, only the fence moves
+        assert(testRM2 == testRM);
+        testRM2[1024 * 1024 + 20] = 'x';
+        assert(heap_validate() < 0);
+        testRM2[1024 * 1024 + 20] = 0;
+
+        heap_free(testRM2);
+        assert(heap_get_used_blocks_count() == 0);
+        heap_set_mmap_threshold(0);
+        assert(heap_validate() == 0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                            MEMALIGN
+
+        size_t alignments[] = {16, 64, 4096, 2 * 1024 * 1024};
+        char * testMG[4];
+        for (int i = 0; i < 4; i++)
+        {
+            testMG[i] = heap_memalign(alignments[i], 100 + i); //Grows the heap when nothing fits
+            assert(testMG[i] != NULL);
+            assert((uintptr_t)testMG[i] % alignments[i] == 0);
+            assert(get_pointer_type(testMG[i]) == pointer_valid);
+            assert(heap_get_block_size(testMG[i]) == 100 + i);
+            memset(testMG[i], 'm', 100 + i);
+        }
+        assert(heap_get_used_blocks_count() == 4);
+        assert(heap_validate() == 0);
+
+        assert(heap_memalign(24, 100) == NULL); //Not a power of two
+        assert(heap_memalign(0, 100) == NULL);
+
+        char * testMG2 = heap_realloc_memalign(64, testMG[0], 5000); //Keeps the 64 byte alignment wherever it lands
+        assert(testMG2 != NULL && (uintptr_t)testMG2 % 64 == 0);
+        assert(testMG2[0] == 'm' && testMG2[99] == 'm');
+        testMG[0] = testMG2;
+
+        char * testMG3 = heap_malloc(100);
+        testMG2 = heap_realloc_memalign(4096, testMG3, 200); //Moves a block which isn't aligned yet
+        assert((uintptr_t)testMG2 % 4096 == 0);
+        heap_free(testMG2);
+
+        testMG2 = heap_calloc_memalign(256, 10, 10);
+        assert(testMG2 != NULL && (uintptr_t)testMG2 % 256 == 0);
+        for (int i = 0; i < 100; i++)
+        {
+            assert(testMG2[i] == 0);
+        }
+        heap_free(testMG2);
+        assert(heap_validate() == 0);
+
+        for (int i = 0; i < 4; i++)
+        {
+            heap_free(testMG[i]);
+        }
+        assert(heap_get_used_blocks_count() == 0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                             STATS
+
+        char * testST2[6];
+        size_t testSTSizes[] = {300, 5000, 40, 5000, 1200, 70};
+        for (int i = 0; i < 6; i++)
+        {
+            testST2[i] = heap_malloc(testSTSizes[i]);
+        }
+        assert(heap_get_largest_used_block_size() == 5000);
+
+        heap_free(testST2[1]); //Another block of the same size is still in use
+        assert(heap_get_largest_used_block_size() == 5000);
+        assert(heap_get_largest_free_area() >= 5000);
+        heap_free(testST2[3]);
+        assert(heap_get_largest_used_block_size() == 1200);
+
+        uint64_t validations_before = heap_get_validation_count();
+        for (int i = 0; i < 100; i++) heap_get_free_space(); //Getters only read counters
+        assert(heap_get_validation_count() == validations_before);
+
+        testST2[1] = heap_realloc(testST2[4], 9000);
+        assert(heap_get_largest_used_block_size() == 9000);
+        assert(heap_get_used_blocks_count() == 4);
+        assert(heap_validate() == 0); //Walk compares the counters with the blocks
+
+        heap_free(testST2[0]);
+        heap_free(testST2[1]);
+        heap_free(testST2[2]);
+        heap_free(testST2[5]);
+        assert(heap_get_used_blocks_count() == 0);
+        assert(heap_get_largest_used_block_size() == 0);
+        assert(heap_get_free_gaps_count() == 1);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                           PLACEMENT
+
+        enum placement_policy_t policies[] = {placement_first_fit, placement_best_fit, placement_next_fit, placement_good_fit};
+        for (int p = 0; p < 4; p++)
+        {
+            heap_set_placement_policy(policies[p]);
+            heap_reset();
+            assert(heap_get_placement_policy() == policies[p]);
+
+            //Holes of 1000, 300 and 2000 bytes with blocks in use between them
+            char * testPL[6];
+            size_t testPLSizes[] = {1000, 100, 300, 100, 2000, 100};
+            for (int i = 0; i < 6; i++) testPL[i] = heap_malloc(testPLSizes[i]);
+            heap_free(testPL[0]);
+            heap_free(testPL[2]);
+            heap_free(testPL[4]);
+
+            char * testPL2 = heap_malloc(200);
+            if (policies[p] == placement_first_fit) assert(testPL2 == testPL[0]); //Lowest address
+            if (policies[p] == placement_best_fit) assert(testPL2 == testPL[2]); //Smallest hole
+            if (policies[p] == placement_next_fit) assert(testPL2 > testPL[5]); //Goes on after the last placed block
+            if (policies[p] == placement_good_fit) assert(testPL2 == testPL[2]); //Smallest bin
+            assert(heap_validate() == 0);
+
+            char * testPL3 = heap_malloc(1500); //Only the 2000 byte hole or the end of the heap hold it
+            assert(testPL3 == testPL[4] || testPL3 > testPL[5]);
+            heap_free(testPL3);
+            heap_free(testPL2);
+            heap_free(testPL[1]);
+            heap_free(testPL[3]);
+            heap_free(testPL[5]);
+            assert(heap_get_used_blocks_count() == 0);
+        }
+
+        //First fit takes a perfect match at a lower address than a block which can be splitted,
+        //even when an even lower block is too large for a perfect match and too small to be splitted
+        heap_set_placement_policy(placement_first_fit);
+        heap_reset();
+        char * testPLFF[6];
+        size_t testPLFFSizes[] = {308, 100, 300, 100, 2000, 100};
+        for (int i = 0; i < 6; i++) testPLFF[i] = heap_malloc(testPLFFSizes[i]);
+        heap_free(testPLFF[0]);
+        heap_free(testPLFF[2]);
+        heap_free(testPLFF[4]);
+        assert(heap_malloc(300) == testPLFF[2]);
+        assert(heap_validate() == 0);
+        heap_set_placement_policy(placement_good_fit);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                          SITE_PROFILE
+
+        heap_set_site_profile(1);
+        heap_reset();
+
+        char * testSP[4];
+        for (int i = 0; i < 3; i++) testSP[i] = heap_malloc(100);
+        testSP[3] = heap_calloc(10, 30);
+        heap_free(testSP[0]);
+        testSP[1] = heap_realloc(testSP[1], 200);
+
+        //Realloc had to move the block, the moved block belongs to the realloc line
+        struct heap_site_stats_t sites[4];
+        assert(heap_get_site_profile(sites, 4) == 3);
+        assert(sites[0].live_bytes == 300 && sites[0].live_count == 1 && sites[0].total_count == 1);
+        assert(sites[1].live_bytes == 200 && sites[1].live_count == 1);
+        assert(sites[2].live_bytes == 100 && sites[2].live_count == 1 && sites[2].total_count == 3);
+        assert(sites[2].peak_bytes == 300 && sites[2].total_bytes == 300);
+        assert(strcmp(sites[0].filename, __FILE__) == 0 && sites[0].line != sites[2].line);
+
+        FILE * profile = tmpfile();
+        assert(heap_dump_site_profile(profile, profile_pprof) == 0);
+        rewind(profile);
+        char profileLine[128];
+        assert(fgets(profileLine, sizeof(profileLine), profile) && strcmp(profileLine, "--- symbol\n") == 0);
+        fclose(profile);
+
+        for (int i = 1; i < 4; i++) heap_free(testSP[i]);
+        assert(heap_get_site_profile(sites, 4) == 3);
+        assert(sites[0].live_bytes == 0 && sites[0].live_count == 0 && sites[2].live_bytes == 0);
+
+        //Blocks waiting in a thread cache aren't live, they count from when they are handed out
+        heap_set_thread_cache(1);
+        heap_reset();
+        void * testSPTC[2];
+        for (int i = 0; i < 2; i++) testSPTC[i] = heap_malloc(40); //Second block comes from the cache filled by the first
+        assert(heap_get_site_profile(sites, 4) == 1);
+        assert(sites[0].live_count == 2 && sites[0].live_bytes == 80 && sites[0].total_count == 2);
+        heap_free(testSPTC[0]);
+        heap_free(testSPTC[1]);
+        heap_set_thread_cache(0); //Gives the cached blocks back without counting them as freed again
+        assert(heap_get_site_profile(sites, 4) == 1);
+        assert(sites[0].live_count == 0 && sites[0].live_bytes == 0 && sites[0].total_count == 2);
+        heap_set_site_profile(0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                            SAMPLING
+
+        //Mean gap of a block size samples about every other block
+        heap_set_sample_interval(512);
+        char * testSA[64];
+        for (int i = 0; i < 64; i++) testSA[i] = heap_malloc(512);
+
+        struct heap_sample_t testSamples[64];
+        int sampled = heap_get_samples(testSamples, 64);
+        assert(sampled > 8 && sampled < 64);
+        for (int i = 0; i < sampled; i++)
+        {
+            assert(testSamples[i].size == 512 && testSamples[i].weight > 512);
+            assert(testSamples[i].depth > 0 && strcmp(testSamples[i].filename, __FILE__) == 0);
+        }
+
+        heap_set_sample_interval(0);
+        assert(heap_dump_samples("/tmp/heap_samples.prof") == 0);
+        FILE * sampleFile = fopen("/tmp/heap_samples.prof", "r");
+        assert(sampleFile && fgets(profileLine, sizeof(profileLine), sampleFile) && strncmp(profileLine, "heap profile: ", 14) == 0);
+        fclose(sampleFile);
+        remove("/tmp/heap_samples.prof");
+
+        //Samples leave with their blocks
+        for (int i = 0; i < 32; i++) heap_free(testSA[i]);
+        int left = heap_get_samples(testSamples, 64);
+        for (int i = 0; i < left; i++)
+        {
+            int live = 0;
+            for (int j = 32; j < 64; j++) live |= testSamples[i].ptr == testSA[j];
+            assert(live);
+        }
+        for (int i = 32; i < 64; i++) heap_free(testSA[i]);
+        assert(heap_get_samples(testSamples, 64) == 0);
+
+        //A slot of the filter shared by more samples than its counter holds still takes the lock
+        struct heap_sample_t testSampleFill = {0};
+        size_t fillSlot = sample_slot(SAMPLE_FILTER_SIZE, (void *)0x100000);
+        for (uintptr_t address = 0x100000, filled = 0; filled < 256; address += 16)
+        {
+            if (sample_slot(SAMPLE_FILTER_SIZE, (void *)address) != fillSlot) continue;
+            testSampleFill.ptr = (void *)address;
+            sample_insert(&testSampleFill);
+            filled++;
+        }
+        assert(sample_filtered((void *)0x100000) == 0);
+        sample_clear();
+        assert(sample_filtered((void *)0x100000) == 1);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                            SNAPSHOT
+
+        char * testSN[8];
+        for (int i = 0; i < 8; i++) testSN[i] = heap_malloc(100 * (i + 1));
+        for (int i = 0; i < 8; i += 2) heap_free(testSN[i]);
+
+        FILE * snapshotFile = tmpfile();
+        assert(heap_write_snapshot(fileno(snapshotFile)) == 0);
+        rewind(snapshotFile);
+
+        struct heap_snapshot_header_t snapshotHeader;
+        assert(fread(&snapshotHeader, sizeof(snapshotHeader), 1, snapshotFile) == 1);
+        assert(memcmp(snapshotHeader.magic, HEAP_SNAPSHOT_MAGIC, 8) == 0 && snapshotHeader.metadata == metadata_size);
+
+        //First section is the first arena, its records follow the chunks in address order
+        struct heap_snapshot_section_t snapshotSection;
+        assert(fread(&snapshotSection, sizeof(snapshotSection), 1, snapshotFile) == 1);
+        assert(snapshotSection.kind == snapshot_arena && snapshotSection.index == 0);
+        uint64_t snapshotUsed = 0, snapshotBytes = 0, previous = 0;
+        for (uint64_t i = 0; i < snapshotSection.count; i++)
+        {
+            struct heap_snapshot_record_t record;
+            assert(fread(&record, sizeof(record), 1, snapshotFile) == 1);
+            assert(record.address > previous);
+            previous = record.address;
+            snapshotBytes += record.size + metadata_size;
+            if (record.flags & SNAPSHOT_TAKEN) snapshotUsed++;
+            if (record.flags & SNAPSHOT_TAKEN) assert(record.line > 0 && record.filename != 0);
+        }
+        assert(snapshotUsed == 4 && snapshotUsed == heap_get_used_blocks_count());
+        assert(snapshotBytes == snapshotSection.length);
+        fclose(snapshotFile);
+
+        for (int i = 1; i < 8; i += 2) heap_free(testSN[i]);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                           REMOTE_FREE
+
+        heap_set_remote_free(1);
+
+        void * testRF[18] = {0};
+        for (int i = 0; i < 16; i++) testRF[i] = heap_malloc(24 + i * 40);
+        testRF[16] = heap_malloc(4); //Nothing is written into a queued block, so tiny ones queue too
+        size_t remote_used = heap_get_used_space();
+
+        pthread_t testRFThread;
+        assert(pthread_create(&testRFThread, NULL, remote_free_worker, testRF) == 0);
+        pthread_join(testRFThread, NULL);
+
+        //Queued blocks still count as used and the heap stays valid until the owner takes its lock
+        assert(heap_validate() == 0);
+        assert(heap_get_used_blocks_count() == 0); //Getters take the lock, which drains the queue
+        assert(heap_get_used_space() < remote_used);
+        assert(heap_validate() == 0);
+
+        //Drained blocks are free to be reused
+        void * testRFReuse = heap_malloc(24);
+        assert(testRFReuse == testRF[0]);
+        heap_free(testRFReuse);
+        assert(heap_get_used_blocks_count() == 0);
+
+        //A block queued twice is reported by the drain and freed once
+        void * testRFTwice[3] = {heap_malloc(40), NULL, NULL};
+        testRFTwice[1] = testRFTwice[0];
+        assert(pthread_create(&testRFThread, NULL, remote_free_worker, testRFTwice) == 0);
+        pthread_join(testRFThread, NULL);
+        assert(heap_get_used_blocks_count() == 0);
+        assert(heap_validate() == 0);
+
+        heap_set_remote_free(0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                              BATCH
+
+        size_t batch_free_space = heap_get_free_space();
+        void * testBA[300];
+        assert(heap_malloc_batch(40, 300, testBA) == 300);
+        assert(heap_get_used_blocks_count() == 300);
+        for (int i = 1; i < 300; i++) assert((char *)testBA[i] == (char *)testBA[i - 1] + 40 + metadata_size); //Carved from one region
+        for (int i = 0; i < 300; i++) assert(get_payload_size(testBA[i]) == 40 && get_pointer_type(testBA[i]) == pointer_valid);
+        assert(heap_validate() == 0);
+
+        //Every other block first, so the second batch merges runs of three blocks into their freed neighbours
+        void * testBAFree[150];
+        for (int i = 0; i < 150; i++) testBAFree[i] = testBA[(i * 2 + 37) % 300 / 2 * 2];
+        heap_free_batch(testBAFree, 150);
+        assert(heap_get_used_blocks_count() == 150);
+        assert(heap_validate() == 0);
+
+        for (int i = 0; i < 150; i++) testBAFree[149 - i] = testBA[i * 2 + 1];
+        heap_free_batch(testBAFree, 150);
+        assert(heap_get_used_blocks_count() == 0);
+        assert(heap_get_free_space() == batch_free_space);
+        assert(heap_validate() == 0);
+
+        //Double frees inside a batch are reported and skipped
+        assert(heap_malloc_batch(100, 2, testBA) == 2);
+        testBA[2] = testBA[0];
+        heap_free_batch(testBA, 3);
+        assert(heap_get_used_blocks_count() == 0);
+        assert(heap_validate() == 0);
+
+        assert(heap_malloc_batch(0, 4, testBA) == 0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                            FREE_SIZED
+
+        void * testFS[4];
+        testFS[0] = heap_malloc(24);
+        testFS[1] = heap_malloc(1000);
+        testFS[2] = heap_malloc(70000);
+        testFS[3] = heap_malloc(300);
+        heap_free_sized(testFS[1], 1000);
+        heap_free_sized(testFS[0], 24);
+        assert(heap_get_used_blocks_count() == 2);
+        assert(heap_validate() == 0);
+
+        //A wrong size is reported and the block is freed the slow way
+        heap_free_sized(testFS[3], 301);
+        assert(heap_get_used_blocks_count() == 1);
+        heap_free_sized(testFS[2], 70000);
+        assert(heap_get_used_blocks_count() == 0);
+
+        //Shrinking by less than a header keeps the block, its new size is still the right one to pass
+        testFS[0] = heap_realloc(heap_malloc(300), 296);
+        assert(get_payload_size(testFS[0]) == 300);
+        assert(free_sized_report(testFS[0], 296) == 0);
+        assert(heap_get_used_blocks_count() == 0);
+
+        //Wrong sizes are caught by the thread cache and by slabs too
+        heap_set_thread_cache(1);
+        assert(free_sized_report(heap_malloc(40), 200) > 0);
+        assert(free_sized_report(heap_malloc(40), 40) == 0);
+        heap_set_thread_cache(0);
+        assert(heap_get_used_blocks_count() == 0);
+        heap_set_slab(1);
+        assert(free_sized_report(heap_malloc(40), 200) > 0);
+        assert(free_sized_report(heap_malloc(40), 16) > 0);
+        assert(free_sized_report(heap_malloc(40), 33) == 0);
+        assert(heap_get_used_blocks_count() == 0);
+        heap_set_slab(0);
+        assert(heap_validate() == 0);
+
+        //Mapped blocks and slab objects
+        heap_set_mmap_threshold(64 * 1024);
+        heap_set_slab(1);
+        testFS[0] = heap_malloc(100000);
+        testFS[1] = heap_malloc(48);
+        testFS[2] = heap_malloc(2000);
+        heap_free_sized(testFS[0], 100000);
+        heap_free_sized(testFS[1], 48);
+        heap_free_sized(testFS[2], 2000);
+        assert(heap_get_used_blocks_count() == 0);
+        assert(heap_validate() == 0);
+        heap_set_slab(0);
+        heap_set_mmap_threshold(0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                             REGION
+
+        struct heap_region_t * testRG = heap_region_create(1000);
+        assert(testRG != NULL);
+        assert(heap_get_used_blocks_count() == 2); //The region and its first chunk
+
+        //Allocations are bumped one after another without headers
+        char * testRGa = heap_region_alloc(testRG, 10, 1);
+        char * testRGb = heap_region_alloc(testRG, 10, 1);
+        assert(testRGa != NULL && testRGb == testRGa + 10);
+        char * testRGc = heap_region_alloc(testRG, 24, 64);
+        assert(testRGc != NULL && (uintptr_t)testRGc % 64 == 0 && testRGc >= testRGb + 10);
+        assert(heap_region_alloc(testRG, 8, 3) == NULL);
+        assert(heap_region_alloc(testRG, 0, 8) == NULL);
+
+        //Chunks are added as the region grows, a large allocation gets a chunk of its own size
+        for (int i = 0; i < 1000; i++)
+        {
+            char * obj = heap_region_alloc(testRG, 100, 0);
+            assert(obj != NULL && (uintptr_t)obj % sizeof(void *) == 0);
+            memset(obj, i, 100);
+        }
+        assert(heap_region_alloc(testRG, 3 * REGION_MAX_CHUNK, 16) != NULL);
+        assert(heap_get_used_blocks_count() > 3);
+        assert(heap_validate() == 0);
+
+        //Reset keeps only the newest chunk, destroy gives everything back
+        heap_region_reset(testRG);
+        assert(heap_get_used_blocks_count() == 2);
+        assert(heap_region_alloc(testRG, 100, 0) != NULL);
+        heap_region_destroy(testRG);
+        assert(heap_get_used_blocks_count() == 0);
+        assert(heap_validate() == 0);
+
+    //####################################################################
+
+    heap_reset();
+
+    //####################################################################
+    //                            LATENCY
+
+        heap_reset_latency_histograms();
+        heap_set_latency_tracking(1);
+
+        //Calloc calls heap_malloc, only the outer call is recorded
+        char * testLA = heap_malloc(100);
+        char * testLA2 = heap_calloc(10, 10);
+        heap_free(testLA);
+        heap_free(testLA2);
+        char * testLA3 = heap_malloc(PAGE_SIZE * 64); //Grows the heap
+        heap_free(testLA3);
+
+        struct latency_histogram_t histogram;
+        assert(heap_get_latency_histogram(latency_malloc, &histogram) == 0);
+        assert(histogram.samples == 2);
+        assert(heap_get_latency_histogram(latency_calloc, &histogram) == 0 && histogram.samples == 1);
+        assert(heap_get_latency_histogram(latency_free, &histogram) == 0 && histogram.samples == 3);
+        assert(heap_get_latency_histogram(latency_lock_wait, &histogram) == 0 && histogram.samples >= 6);
+        assert(heap_get_latency_histogram(latency_grow, &histogram) == 0 && histogram.samples >= 1);
+        assert(heap_get_latency_histogram(LATENCY_KIND_COUNT, &histogram) == -1);
+
+        uint64_t total = 0;
+        heap_get_latency_histogram(latency_free, &histogram);
+        for (int i = 0; i < LATENCY_BUCKET_COUNT; i++) total += histogram.counts[i];
+        assert(total == histogram.samples);
+        assert(heap_latency_percentile(&histogram, 0.5) <= heap_latency_percentile(&histogram, 0.999));
+        assert(heap_latency_percentile(&histogram, 0.999) <= histogram.max_ticks * 2);
+
+        //Nothing is recorded once tracking is off
+        heap_set_latency_tracking(0);
+        heap_reset_latency_histograms();
+        heap_free(heap_malloc(100));
+        heap_get_latency_histogram(latency_malloc, &histogram);
+        assert(histogram.samples == 0);
+
+    //####################################################################
+
+    heap_reset();
+
     //####################################################################
     //                          DEFAULT_TEST
 